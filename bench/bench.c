@@ -0,0 +1,626 @@
+#define _GNU_SOURCE
+#include <cjson/cJSON.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <ncurses.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/backup.h"
+#include "../src/date.h"
+#include "../src/file.h"
+#include "../src/graphics.h"
+#include "../src/grep.h"
+#include "../src/journal.h"
+#include "../src/json.h"
+#include "../src/scan.h"
+#include "../src/search.h"
+#include "../src/snapshot.h"
+#include "../src/store.h"
+#include "../src/trigram.h"
+#include "../src/util.h"
+#include "../src/version.h"
+
+/*
+ * Micro-benchmarks of the hot paths, run against each calendar file named on
+ * the command line. Every result is printed as one JSON object per line, so
+ * runs of different versions can be kept and compared.
+ *
+ * An operation is timed in batches long enough for the clock to resolve, and
+ * the percentiles are of the time per operation within each batch.
+ */
+
+#define BATCH_NS 20000.0
+#define MAX_SAMPLES 100000
+
+static double budget = 0.5;
+static char *only;
+static char *calendar;
+
+/*
+ * The state shared by the operations, set up once per calendar
+ */
+static char *path;
+static struct store store;
+static cJSON *root;
+static cJSON *days;
+static cJSON *weekdays;
+static int *filled;
+static int filled_count;
+static char **texts;
+static char **escaped;
+static size_t *escaped_length;
+static size_t text_bytes;
+static size_t escaped_bytes;
+static struct screen screen;
+static struct search search;
+static struct trigrams trigrams;
+static unsigned long generation;
+static int today;
+static int step;
+
+/*
+ * The days object as the whole file parsed by cJSON gives it, and the tags of
+ * the filled days, to compare the store's lookups against
+ */
+static cJSON *tree;
+static cJSON *tree_days;
+static char (*tags)[DATE_LEN];
+
+/*
+ * A copy of the calendar in a temporary directory, with its journal and
+ * backups, for the save benchmarks
+ */
+static char save_dir[PATH_MAX];
+static char save_path[PATH_MAX + 16];
+static struct journal journal;
+static struct backup backups;
+static struct retention retention = {60 * 60, 24, 30, 52, 10};
+static int edits;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Time 'op' for about 'budget' seconds and print its throughput and the
+ * percentiles of its time per operation. 'bytes' is the input size of one
+ * operation, or 0 if a rate in bytes makes no sense for it.
+ */
+static void run(char *name, char *variant, void (*op)(), size_t bytes) {
+  char full[128];
+  snprintf(full, sizeof(full), "%s%s%s", name, *variant ? "/" : "", variant);
+  if (only && !strstr(full, only)) {
+    return;
+  }
+
+  double start = now();
+  op();
+  double first = now() - start;
+  long batch = first >= BATCH_NS ? 1 : BATCH_NS / (first > 1 ? first : 1);
+
+  static double samples[MAX_SAMPLES];
+  int count = 0;
+  long ops = 0;
+  double total = 0;
+  while (count < MAX_SAMPLES && (count < 10 || total < budget * 1e9)) {
+    start = now();
+    for (long i = 0; i < batch; i++) {
+      op();
+    }
+    double elapsed = now() - start;
+    samples[count++] = elapsed / batch;
+    ops += batch;
+    total += elapsed;
+  }
+  qsort(samples, count, sizeof(double), compare_doubles);
+
+  printf("{\"version\":\"%s\",\"calendar\":\"%s\",\"benchmark\":\"%s\",\"engine\":\"%s\",\"ops\":%ld,"
+         "\"ops_per_sec\":%.1f,",
+         VERSION_STRING_SHORT, calendar, full, scan_engine(), ops, ops / (total / 1e9));
+  if (bytes) {
+    printf("\"mb_per_sec\":%.1f,", bytes * ops / (total / 1e9) / 1e6);
+  }
+  printf("\"ns_min\":%.0f,\"ns_p50\":%.0f,\"ns_p90\":%.0f,\"ns_p99\":%.0f,\"ns_max\":%.0f}\n", samples[0],
+         samples[count / 2], samples[count * 9 / 10], samples[count * 99 / 100], samples[count - 1]);
+  fflush(stdout);
+}
+
+/*
+ * Map and load the calendar the way the program does when there is no
+ * snapshot, into 'store' and 'root'
+ */
+static void load(struct store *store, cJSON **root) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  char *buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t error;
+  *root = store_load(store, buffer, st.st_size, 1, &error);
+  if (!*root) {
+    fprintf(stderr, "Could not parse \"%s\" near byte %zu.\n", path, error);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void op_load() {
+  struct store s = {0};
+  cJSON *r;
+  load(&s, &r);
+  cJSON_Delete(r);
+  store_free(&s);
+}
+
+static void op_load_decode() {
+  struct store s = {0};
+  cJSON *r;
+  load(&s, &r);
+  for (int i = 0; i < filled_count; i++) {
+    store_data(&s, filled[i]);
+  }
+  cJSON_Delete(r);
+  store_free(&s);
+}
+
+/*
+ * Looking up a day: in the store by its row, and in the days object of the
+ * parsed file by its tag, as every lookup did before the store
+ */
+static void op_find_store() {
+  step = (step + 7919) % filled_count;
+  int row = store_row(&store, filled[step]);
+  if (row < 0 || !(store.flags[row] & STORE_PRESENT)) {
+    abort();
+  }
+}
+
+static void op_find_tree() {
+  step = (step + 7919) % filled_count;
+  if (!find(tree_days, tags[step])) {
+    abort();
+  }
+}
+
+static void op_store_data() {
+  step = (step + 7919) % filled_count;
+  store_data(&store, filled[step]);
+}
+
+static void op_count_tasks() {
+  int lines;
+  int green;
+  int yellow;
+  int red;
+  int blue;
+  for (int i = 0; i < filled_count; i++) {
+    count_tasks(texts[i], &lines, &green, &yellow, &red, &blue);
+  }
+}
+
+static void op_count_escaped() {
+  int lines;
+  int green;
+  int yellow;
+  int red;
+  int blue;
+  for (int i = 0; i < filled_count; i++) {
+    if (escaped[i]) {
+      count_escaped(escaped[i], escaped_length[i], &lines, &green, &yellow, &red, &blue);
+    }
+  }
+}
+
+/*
+ * Every search starts over, as it does when the pattern is edited or the data
+ * changes
+ */
+static void op_search() {
+  search_set(&search, "meet.*budget", 0, ++generation);
+  for (int i = 0; i < filled_count; i++) {
+    search_match(&search, filled[i], store_data(&store, filled[i]));
+  }
+}
+
+static void op_search_icase() {
+  search_set(&search, "lisbon", REG_ICASE, ++generation);
+  for (int i = 0; i < filled_count; i++) {
+    search_match(&search, filled[i], store_data(&store, filled[i]));
+  }
+}
+
+static void op_index() {
+  trigram_free(&trigrams);
+  for (int i = 0; i < filled_count; i++) {
+    trigram_add(&trigrams, filled[i], texts[i]);
+  }
+  trigrams.built = 1;
+}
+
+/*
+ * The same search as op_search(), with only the days the index gives tested
+ */
+static void op_search_trigram() {
+  int *docs;
+  search_set(&search, "meet.*budget", 0, ++generation);
+  int count = trigram_query(&trigrams, search.pattern, search.flags, &docs);
+  for (int i = 0; i < count; i++) {
+    search_match(&search, docs[i], store_data(&store, docs[i]));
+  }
+  free(docs);
+}
+
+/*
+ * The same search as op_search(), over every day on one thread or on all of
+ * them
+ */
+static void op_grep() {
+  int *matches;
+  grep_days(&store, filled, filled_count, "meet.*budget", 0, &matches);
+  free(matches);
+}
+
+static void op_grep_literal() {
+  int *matches;
+  grep_days(&store, filled, filled_count, "budget", 0, &matches);
+  free(matches);
+}
+
+/*
+ * The panes are drawn for a cursor that keeps moving, so that doupdate()
+ * always has something to send
+ */
+static void op_draw_cal_pane() {
+  step = (step + 1) % 28;
+  werase(screen.calendar);
+  draw_cal_pane(screen.calendar, 0, step, &search, today, &store, 0);
+  wnoutrefresh(screen.calendar);
+  doupdate();
+}
+
+static void op_draw_day_pane() {
+  step = (step + 7919) % filled_count;
+  werase(screen.day);
+  draw_day_pane(screen.day, filled[step] - today, today, &store);
+  wnoutrefresh(screen.day);
+  doupdate();
+}
+
+static void op_frame() {
+  static char status_line[256];
+  step = (step + 1) % 28;
+  struct view view = {0, step, today, 0, 0, generation};
+  screen_draw(&screen, &view, &search, status_line, &store, weekdays);
+  doupdate();
+}
+
+static void op_store_write() {
+  FILE *f = fopen("/dev/null", "w");
+  store_write(&store, f, days, 1);
+  fclose(f);
+}
+
+/*
+ * The steps of save() after a day was edited in the open calendar, on the
+ * copy in 'save_dir'. Every save adds a backup and thins out the old ones,
+ * and refreshes the snapshot.
+ */
+static void edit_one() {
+  char text[64];
+  step = (step + 7919) % filled_count;
+  snprintf(text, sizeof(text), "o edited %d\n+ task\n", ++edits);
+  store_set_data(&store, filled[step], text);
+}
+
+static void take_backup() {
+  struct stat st;
+  if (backup_save(&backups, root, &store, time(0)) != 0 || stat(save_path, &st) != 0) {
+    perror(save_dir);
+    exit(EXIT_FAILURE);
+  }
+  snapshot_update(save_path, &store, &st);
+  backup_prune(&backups, &retention, time(0));
+  backup_gc(&backups);
+}
+
+/*
+ * A routine save, which appends the edited day to the journal and syncs it.
+ * The journal is started over before it grows to the size at which save()
+ * would compact it instead.
+ */
+static void op_save_journal() {
+  edit_one();
+  if (journal.size >= JOURNAL_LIMIT) {
+    journal_reset(&journal);
+  }
+  if (journal_append(&journal, save_path, &store, NULL) != 0) {
+    perror(journal.path);
+    exit(EXIT_FAILURE);
+  }
+  store_saved(&store);
+  take_backup();
+}
+
+/*
+ * A compacting save, which streams the whole calendar into a temporary file,
+ * syncs it, renames it over the calendar and drops the journal
+ */
+static void op_save_compact() {
+  edit_one();
+  struct atomic_file file;
+  int failed = atomic_open(&file, save_path) != 0;
+  if (!failed) {
+    fputs("{\n", file.f);
+    for (cJSON *node = root->child; node; node = node->next) {
+      json_indent(file.f, 1);
+      json_write_string(file.f, node->string);
+      fputs(":\t", file.f);
+      if (node == days) {
+        store_write(&store, file.f, days, 1);
+      } else {
+        json_write(file.f, node, 1);
+      }
+      fputs(node->next ? ",\n" : "\n", file.f);
+    }
+    putc('}', file.f);
+    failed = atomic_commit(&file) != 0;
+  }
+  if (failed) {
+    perror(save_path);
+    exit(EXIT_FAILURE);
+  }
+  journal_reset(&journal);
+  store_saved(&store);
+  take_backup();
+}
+
+static int remove_entry(const char *entry, const struct stat *st, int type, struct FTW *ftw) {
+  return remove(entry);
+}
+
+/*
+ * Copy the calendar into a new temporary directory with an empty backup
+ * store
+ */
+static void save_setup() {
+  char *tmp = getenv("TMPDIR");
+  snprintf(save_dir, sizeof(save_dir), "%s/bench.XXXXXX", tmp ? tmp : "/tmp");
+  if (!mkdtemp(save_dir)) {
+    perror(save_dir);
+    exit(EXIT_FAILURE);
+  }
+  snprintf(save_path, sizeof(save_path), "%s/%s", save_dir, calendar);
+
+  struct atomic_file file;
+  if (atomic_open(&file, save_path) != 0) {
+    perror(save_path);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(store.source, 1, store.source_size, file.f);
+  if (atomic_commit(&file) != 0) {
+    perror(save_path);
+    exit(EXIT_FAILURE);
+  }
+
+  char dir[PATH_MAX + 16];
+  snprintf(dir, sizeof(dir), "%s/backups", save_dir);
+  backup_open(&backups, dir);
+  memset(&journal, 0, sizeof(journal));
+  edits = 0;
+
+  /*
+   * The first backup stores every day, which later ones share
+   */
+  take_backup();
+}
+
+static void save_teardown() {
+  backup_free(&backups);
+  nftw(save_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+ * Write 'text' as the data of every tenth day, as if they had been edited
+ */
+static void edit(char *text) {
+  for (int i = 0; i < filled_count; i += 10) {
+    store_set_data(&store, filled[i], text);
+  }
+}
+
+static void setup() {
+  load(&store, &root);
+  days = find(root, "days");
+  weekdays = find(root, "weekdays");
+
+  filled = malloc(store.rows * sizeof(int));
+  texts = malloc(store.rows * sizeof(char *));
+  escaped = malloc(store.rows * sizeof(char *));
+  escaped_length = malloc(store.rows * sizeof(size_t));
+  filled_count = 0;
+  text_bytes = 0;
+  escaped_bytes = 0;
+  for (int row = 0; row < store.rows; row++) {
+    if (!(store.flags[row] & (STORE_DATA | STORE_ENCODED))) {
+      continue;
+    }
+    escaped[filled_count] = NULL;
+    if (store.flags[row] & STORE_ENCODED) {
+      escaped[filled_count] = store.source + store.raw[row];
+      escaped_length[filled_count] = store.raw_length[row];
+      escaped_bytes += store.raw_length[row];
+    }
+    filled[filled_count++] = store.base + row;
+  }
+  if (!filled_count) {
+    fprintf(stderr, "\"%s\" has no days.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  /*
+   * Decoding a day can move the arena, so the texts are only collected once
+   * every day is decoded
+   */
+  for (int i = 0; i < filled_count; i++) {
+    store_data(&store, filled[i]);
+  }
+  for (int i = 0; i < filled_count; i++) {
+    texts[i] = store_data(&store, filled[i]);
+    text_bytes += strlen(texts[i]);
+  }
+  today = filled[filled_count / 2];
+  step = 0;
+
+  char *copy = malloc(store.source_size + 1);
+  memcpy(copy, store.source, store.source_size);
+  copy[store.source_size] = 0;
+  tree = cJSON_Parse(copy);
+  free(copy);
+  tree_days = find(tree, "days");
+  tags = malloc(filled_count * sizeof(*tags));
+  for (int i = 0; i < filled_count; i++) {
+    date_format(filled[i], tags[i]);
+  }
+}
+
+static void teardown() {
+  search_free(&search);
+  memset(&search, 0, sizeof(search));
+  trigram_free(&trigrams);
+  cJSON_Delete(tree);
+  free(tags);
+  cJSON_Delete(root);
+  store_free(&store);
+  free(filled);
+  free(texts);
+  free(escaped);
+  free(escaped_length);
+}
+
+/*
+ * Draw to a terminal that writes to /dev/null. Returns -1 if there is none.
+ */
+static int open_terminal(SCREEN **term) {
+  setenv("LINES", "40", 1);
+  setenv("COLUMNS", "120", 1);
+  FILE *out = fopen("/dev/null", "w");
+  FILE *in = fopen("/dev/null", "r");
+  *term = newterm(getenv("TERM") ? getenv("TERM") : "xterm", out, in);
+  if (!*term) {
+    *term = newterm("xterm", out, in);
+  }
+  if (!*term) {
+    fclose(out);
+    fclose(in);
+    return -1;
+  }
+  start_color();
+  for (int i = 1; i <= 8; i++) {
+    init_pair(i, i % 8, COLOR_BLACK);
+  }
+  return 0;
+}
+
+static void bench_calendar() {
+  static char *engines[] = {"avx2", "sse2", "portable"};
+  setup();
+
+  run("load", "", op_load, 0);
+  run("load_decode", "", op_load_decode, 0);
+  run("find", "store", op_find_store, 0);
+  run("find", "tree", op_find_tree, 0);
+  run("store_data", "", op_store_data, 0);
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+    if (scan_select(engines[i]) == 0) {
+      run("count_tasks", engines[i], op_count_tasks, text_bytes);
+      run("count_escaped", engines[i], op_count_escaped, escaped_bytes);
+    }
+  }
+  scan_select(NULL);
+  run("search", "regex", op_search, text_bytes);
+  run("search", "icase", op_search_icase, text_bytes);
+  grep_threads(1);
+  run("grep", "regex/1", op_grep, text_bytes);
+  run("grep", "literal/1", op_grep_literal, text_bytes);
+  grep_threads(0);
+  run("grep", "regex", op_grep, text_bytes);
+  run("grep", "literal", op_grep_literal, text_bytes);
+  run("index", "", op_index, text_bytes);
+  op_index();
+  run("search", "trigram", op_search_trigram, text_bytes);
+
+  search_set(&search, "", 0, ++generation);
+  SCREEN *term;
+  if (open_terminal(&term) == 0) {
+    screen_layout(&screen);
+    run("draw_cal_pane", "", op_draw_cal_pane, 0);
+    run("draw_day_pane", "", op_draw_day_pane, 0);
+    run("frame", "", op_frame, 0);
+    screen_free(&screen);
+    endwin();
+    delscreen(term);
+  } else {
+    fprintf(stderr, "No terminal description, skipping the drawing benchmarks.\n");
+  }
+
+  run("store_write", "clean", op_store_write, 0);
+  edit("o edited\n+ task\n");
+  run("store_write", "edited", op_store_write, 0);
+
+  save_setup();
+  run("save", "journal", op_save_journal, 0);
+  run("save", "compact", op_save_compact, 0);
+  save_teardown();
+
+  teardown();
+}
+
+static void usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [-t SECONDS] [-f FILTER] CALENDAR...\n", argv[0]);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+    if (opt == 't') {
+      budget = atof(optarg);
+    } else if (opt == 'f') {
+      only = optarg;
+    } else {
+      usage(argv);
+    }
+  }
+  if (optind >= argc) {
+    usage(argv);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    path = argv[i];
+    calendar = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    bench_calendar();
+  }
+  return EXIT_SUCCESS;
+}
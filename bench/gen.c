@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/date.h"
+#include "../src/version.h"
+
+/*
+ * Write a synthetic calendar covering a number of years to stdout, for the
+ * benchmarks. The same arguments always produce the same file.
+ *
+ * Most days hold a few short task lines, some hold long notes, and a share of
+ * them have escaped quotes, tabs and \u sequences so that both the raw and the
+ * escaped scanning paths are exercised.
+ */
+
+static unsigned long long state = 0x9e3779b97f4a7c15ULL;
+
+/*
+ * xorshift64*, so the output does not depend on the C library
+ */
+static unsigned int next() {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+/*
+ * A number in [0, n)
+ */
+static int pick(int n) { return next() % n; }
+
+static char *words[] = {
+    "call",    "email",   "review",   "meeting", "with",    "the",      "team",    "about",    "budget",
+    "report",  "dentist", "groceries", "laundry", "pay",     "rent",     "invoice", "draft",    "slides",
+    "for",     "Monday",  "project",  "deadline", "book",    "flights",  "to",      "Lisbon",   "fix",
+    "bug",     "in",      "parser",   "release", "notes",   "gym",      "run",     "5k",       "read",
+    "chapter", "of",      "novel",    "water",   "plants",  "renew",    "passport", "and",     "update",
+    "CV",      "lunch",   "Sam",      "room",    "4.12",    "standup",  "plan",    "sprint",   "backup",
+};
+
+/*
+ * Write a line of text: 'count' words, sometimes with something that has to
+ * be escaped
+ */
+static void line(int count) {
+  for (int i = 0; i < count; i++) {
+    if (i) {
+      putchar(' ');
+    }
+    int r = pick(100);
+    if (r < 2) {
+      fputs("\\\"quoted\\\"", stdout);
+    } else if (r < 3) {
+      fputs("caf\\u00e9", stdout);
+    } else if (r < 4) {
+      fputs("\\tindented", stdout);
+    } else if (r < 5) {
+      fputs("C:\\\\path", stdout);
+    } else {
+      fputs(words[pick(sizeof(words) / sizeof(*words))], stdout);
+    }
+  }
+}
+
+/*
+ * Write the escaped text of a day: mostly a handful of marked tasks, now and
+ * then a long note
+ */
+static void text(int long_note) {
+  static char *markers[] = {"o ", "o ", "o ", "x ", "x ", "+ ", "+ ", "- ", "! ", "", ""};
+  int lines = long_note ? 20 + pick(60) : 1 + pick(3) + pick(3);
+  for (int i = 0; i < lines; i++) {
+    if (!long_note || pick(4) == 0) {
+      fputs(markers[pick(sizeof(markers) / sizeof(*markers))], stdout);
+    }
+    line(long_note ? 4 + pick(12) : 2 + pick(6));
+    fputs("\\n", stdout);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s YEARS [SEED]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int years = atoi(argv[1]);
+  if (argc > 2) {
+    state += strtoull(argv[2], NULL, 10) * 0x9e3779b97f4a7c15ULL;
+  }
+
+  static char *weekdays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  printf("{\n\t\"weekdays\":\t{\n");
+  for (int i = 0; i < 7; i++) {
+    printf("\t\t\"%s\":\t{\n\t\t\t\"data\":\t\"", weekdays[i]);
+    text(0);
+    printf("\"\n\t\t}%s\n", i < 6 ? "," : "");
+  }
+  printf("\t},\n\t\"backlog\":\t{\n\t\t\"data\":\t\"");
+  text(1);
+  printf("\"\n\t},\n\t\"days\":\t{\n");
+
+  /*
+   * The calendar ends on a fixed day so that the output does not depend on
+   * when it is generated. About one day in four is left empty.
+   */
+  int last = days_from_civil(2030, 12, 31);
+  int first = last - years * 365 - years / 4 + 1;
+
+  int written = 0;
+  char tag[DATE_LEN];
+  for (int d = first; d <= last; d++) {
+    if (pick(4) == 0) {
+      continue;
+    }
+    date_format(d, tag);
+    printf("%s\t\t\"%s\":\t{\n\t\t\t\"data\":\t\"", written++ ? ",\n" : "", tag);
+    text(pick(20) == 0);
+    putchar('"');
+    if (pick(5) == 0) {
+      printf(",\n\t\t\t\"mask\":\t%d", 1 + pick(15));
+    }
+    printf("\n\t\t}");
+  }
+  printf("\n\t},\n\t\"version\":\t\"%s\"\n}", VERSION_STRING_SHORT);
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,9 @@
 #!/bin/bash
 
 # This is an example. You should modify it to work with your own setup.
+#
+# Run the calendar with `--publish public`, which writes public/manifest.json
+# and a file per month under public/data/ before this runs. Only the months
+# that changed are written again, so rsync only uploads those.
 
-sed '1s/^/let data=/' data.json > public/data.js && \
-  scp public/data.js public/index.html public/script.js \
-  user@example.com:~/calendar/my-calendar
+rsync -a public/ user@example.com:~/calendar/my-calendar
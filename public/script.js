@@ -1,52 +1,158 @@
 let node=document.querySelector("#node")
 
-let weekday_names=[
-  "Sun",
-  "Mon",
-  "Tue",
-  "Wed",
-  "Thu",
-  "Fri",
-  "Sat"
-]
-
-let days=[]
-let weekdays={}
-
-for (let entry in data){
-  let date=new Date(entry)
-  date.setTime(date.getTime() + date.getTimezoneOffset()*60*1000);
-  if(!isNaN(date)){
-    days.push({
-      "date":date,
-      "data":data[entry].data
-    })
-  }else{
-    weekdays[entry]=data[entry].data
-  }
-}
-
-days=days.sort((a,b)=>{return a.date>b.date})
-
-let html=""
-for (let d of days){
+/*
+ * The calendar is published as manifest.json, with the recurring tasks and a
+ * hash for every month that has entries, and a file of JSON lines per month
+ * under data/. Only the months around today are fetched at first, and the
+ * ones before and after them as they are scrolled into view.
+ */
+let manifest=null
+let months=[]
+let first=0
+let last=-1
+let loading=false
+let observer=null
+
+let top_sentinel=document.createElement("div")
+let bottom_sentinel=document.createElement("div")
+node.appendChild(top_sentinel)
+node.appendChild(bottom_sentinel)
+
+function today_tag(){
   let today=new Date()
-  if(
-    d.date.getYear()==today.getYear() &&
-    d.date.getMonth()==today.getMonth() &&
-    d.date.getDate()==today.getDate()
-  ){
-    html+="<div id=today style='color:red'><pre>"
-  }else{
-    html+="<div><pre>"
-  }
-  html+=d.date
-  html+="<br>"
-  html+=d.data
-  html+=weekdays[weekday_names[d.date.getDay()]]
-  html+="</pre></div>"
-  html+="<br>"
-}
-node.innerHTML=html
-
-document.querySelector("#today").scrollIntoView()
+  let pad=(n)=>String(n).padStart(2,"0")
+  return today.getFullYear()+"-"+pad(today.getMonth()+1)+"-"+pad(today.getDate())
+}
+
+/*
+ * The lines of a recurring entry, each marked "+" if it was checked off on
+ * the day and "o" if not. Blank lines do not take a bit of the mask, as in
+ * the terminal.
+ */
+function recurring_text(text,mask){
+  let lines=[]
+  let n=0
+  for (let line of text.split("\n")){
+    if(line){
+      n++
+      lines.push((mask>>n&1?"+ ":"o ")+line)
+    }
+  }
+  return lines.join("\n")
+}
+
+function render_day(day){
+  let div=document.createElement("div")
+  let pre=document.createElement("pre")
+  if(day.date==today_tag()){
+    div.id="today"
+    div.style.color="red"
+  }
+  let text=day.date+" "+day.weekday+"\n"+(day.data||"")
+  let recurring=manifest.weekdays[day.weekday]
+  if(recurring){
+    text+=recurring_text(recurring,day.mask||0)
+  }
+  pre.textContent=text
+  div.appendChild(pre)
+  div.appendChild(document.createElement("br"))
+  return div
+}
+
+/*
+ * Observe the sentinels afresh, which reports them again if they are still in
+ * view after a short month was added or while another month was loading
+ */
+function watch(){
+  if(observer){
+    for (let sentinel of [top_sentinel,bottom_sentinel]){
+      observer.unobserve(sentinel)
+      observer.observe(sentinel)
+    }
+  }
+}
+
+async function fetch_month(month){
+  let response=await fetch("data/"+month+".jsonl?"+manifest.months[month])
+  let text=await response.text()
+  let section=document.createElement("section")
+  let heading=document.createElement("h2")
+  heading.textContent=month
+  section.appendChild(heading)
+  for (let line of text.split("\n")){
+    if(line){
+      section.appendChild(render_day(JSON.parse(line)))
+    }
+  }
+  return section
+}
+
+/*
+ * Add the month before the first one shown, keeping the page where it was
+ */
+async function load_earlier(){
+  if(loading || first<=0){
+    return
+  }
+  loading=true
+  let section=await fetch_month(months[first-1])
+  let height=document.documentElement.scrollHeight
+  node.insertBefore(section,top_sentinel.nextSibling)
+  window.scrollBy(0,document.documentElement.scrollHeight-height)
+  first--
+  loading=false
+  watch()
+}
+
+async function load_later(){
+  if(loading || last>=months.length-1){
+    return
+  }
+  loading=true
+  let section=await fetch_month(months[last+1])
+  node.insertBefore(section,bottom_sentinel)
+  last++
+  loading=false
+  watch()
+}
+
+async function start(){
+  let response=await fetch("manifest.json",{cache:"no-cache"})
+  manifest=await response.json()
+  months=Object.keys(manifest.months).sort()
+  if(!months.length){
+    return
+  }
+
+  let current=today_tag().slice(0,7)
+  let index=months.findIndex((month)=>month>=current)
+  if(index<0){
+    index=months.length-1
+  }
+  first=index
+  last=index-1
+  await load_later()
+  await load_later()
+  await load_earlier()
+
+  let today=document.querySelector("#today")
+  if(today){
+    today.scrollIntoView()
+  }
+
+  observer=new IntersectionObserver((entries)=>{
+    for (let entry of entries){
+      if(!entry.isIntersecting){
+        continue
+      }
+      if(entry.target==top_sentinel){
+        load_earlier()
+      }else{
+        load_later()
+      }
+    }
+  },{rootMargin:"1000px"})
+  watch()
+}
+
+start()
@@ -9,9 +9,8 @@ usage (){
   echo "to 2022-08-06, the second line to 2022-08-07, etc..."
   echo
   echo "The optional increment value is specified after the filename which is"
-  echo "mandatory. The value defaults to 1. Any value other than a number will be"
-  echo "counted as zero. A value of 2 will skip 1 day for every item added to the"
-  echo "calendar, a value of 3 will skip 2 days, etc..."
+  echo "mandatory. The value defaults to 1. A value of 2 will skip 1 day for every"
+  echo "item added to the calendar, a value of 3 will skip 2 days, etc..."
   exit 1
 }
 
@@ -19,9 +18,4 @@ increment=1
 
 [ "$#" -eq "1" ] || { [ "$#" -eq "2" ] && { increment=$2; } } || usage
 
-i=1
-
-while read line; do
-  terminal_calendar --cli append $(date -Idate -d "$i day") "$line"
-  i=$((i+increment))
-done < $1
+terminal_calendar --cli import "$1" 1 "$increment"
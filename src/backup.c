@@ -0,0 +1,809 @@
+#include <cjson/cJSON.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "backup.h"
+#include "date.h"
+#include "file.h"
+#include "sha256.h"
+#include "store.h"
+#include "util.h"
+
+/*
+ * Each object in the pack is preceded by its digest and two little-endian
+ * 32-bit lengths, compressed and then uncompressed
+ */
+#define HEADER (SHA256_LEN + 8)
+#define HEX_LEN (SHA256_LEN * 2 + 1)
+#define MAGIC "termcal-backup 1"
+
+static void put32(unsigned char *p, unsigned long value) {
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static unsigned long get32(unsigned char *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static int parse_hex(char *hex, unsigned char *digest) {
+  for (int i = 0; i < SHA256_LEN * 2; i++) {
+    char c = hex[i];
+    int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    if (value < 0) {
+      return 0;
+    }
+    if (i % 2) {
+      digest[i / 2] |= value;
+    } else {
+      digest[i / 2] = value << 4;
+    }
+  }
+  return hex[SHA256_LEN * 2] == 0;
+}
+
+/*
+ * Backup ids are the epoch second of the save, so anything else is not a
+ * backup
+ */
+static int is_id(char *name) { return *name && strspn(name, "0123456789") == strlen(name); }
+
+/*
+ * The path of manifest 'id'. A path that does not fit comes out empty, which
+ * no file can be opened as.
+ */
+static char *manifest_path(struct backup *backup, long id, char *path) {
+  if (snprintf(path, PATH_MAX, "%s/%ld", backup->manifests, id) >= PATH_MAX) {
+    *path = 0;
+  }
+  return path;
+}
+
+/*
+ * Read a whole file into a terminated buffer, or return NULL
+ */
+static char *read_text(char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+
+  char *text = size >= 0 ? malloc(size + 1) : NULL;
+  if (text && fread(text, 1, size, f) != size) {
+    free(text);
+    text = NULL;
+  }
+  if (text) {
+    text[size] = 0;
+  }
+  fclose(f);
+  return text;
+}
+
+static int cmp_id(const void *a, const void *b) {
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * The ids found in a directory, oldest first
+ */
+static long *list_ids(char *path, int *count) {
+  *count = 0;
+  DIR *dirp = opendir(path);
+  if (!dirp) {
+    return NULL;
+  }
+
+  long *ids = NULL;
+  int capacity = 0;
+  struct dirent *d;
+  while ((d = readdir(dirp))) {
+    if (!is_id(d->d_name)) {
+      continue;
+    }
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      ids = realloc(ids, capacity * sizeof(long));
+      if (!ids) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    ids[(*count)++] = strtol(d->d_name, NULL, 10);
+  }
+  closedir(dirp);
+
+  qsort(ids, *count, sizeof(long), cmp_id);
+  return ids;
+}
+
+static void reset(struct backup *backup) {
+  for (unsigned int i = 0; i < backup->capacity; i++) {
+    backup->offsets[i] = -1;
+  }
+  backup->count = 0;
+  backup->size = 0;
+}
+
+/*
+ * The slot holding 'digest', or the empty slot where it would go
+ */
+static unsigned int slot(struct backup *backup, unsigned char *digest) {
+  unsigned int mask = backup->capacity - 1;
+  for (unsigned int i = get32(digest) & mask;; i = (i + 1) & mask) {
+    if (backup->offsets[i] < 0 || memcmp(backup->keys[i], digest, SHA256_LEN) == 0) {
+      return i;
+    }
+  }
+}
+
+static long lookup(struct backup *backup, unsigned char *digest) {
+  if (!backup->capacity) {
+    return -1;
+  }
+  return backup->offsets[slot(backup, digest)];
+}
+
+static void insert(struct backup *backup, unsigned char *digest, long offset) {
+  if ((backup->count + 1) * 2 > backup->capacity) {
+    unsigned int old = backup->capacity;
+    unsigned char(*keys)[SHA256_LEN] = backup->keys;
+    long *offsets = backup->offsets;
+
+    backup->capacity = old ? old * 2 : 1024;
+    backup->keys = malloc(backup->capacity * sizeof(*keys));
+    backup->offsets = malloc(backup->capacity * sizeof(long));
+    if (!backup->keys || !backup->offsets) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    for (unsigned int i = 0; i < backup->capacity; i++) {
+      backup->offsets[i] = -1;
+    }
+    for (unsigned int i = 0; i < old; i++) {
+      if (offsets[i] >= 0) {
+        unsigned int j = slot(backup, keys[i]);
+        memcpy(backup->keys[j], keys[i], SHA256_LEN);
+        backup->offsets[j] = offsets[i];
+      }
+    }
+    free(keys);
+    free(offsets);
+  }
+
+  unsigned int i = slot(backup, digest);
+  if (backup->offsets[i] < 0) {
+    backup->count++;
+  }
+  memcpy(backup->keys[i], digest, SHA256_LEN);
+  backup->offsets[i] = offset;
+}
+
+/*
+ * Index the objects appended to the pack since it was last read. A record cut
+ * short by a crash is ignored, and truncated away when the pack is open for
+ * writing.
+ */
+static void scan(struct backup *backup, FILE *pack, int writing) {
+  struct stat st;
+  if (fstat(fileno(pack), &st) != 0) {
+    return;
+  }
+  if (st.st_dev != backup->device || st.st_ino != backup->inode || st.st_size < backup->size) {
+    reset(backup);
+    backup->device = st.st_dev;
+    backup->inode = st.st_ino;
+  }
+
+  long offset = backup->size;
+  unsigned char header[HEADER];
+  while (offset + HEADER <= st.st_size) {
+    if (fseek(pack, offset, SEEK_SET) != 0 || fread(header, 1, HEADER, pack) != HEADER) {
+      break;
+    }
+    long next = offset + HEADER + get32(header + SHA256_LEN);
+    if (next > st.st_size) {
+      break;
+    }
+    insert(backup, header, offset);
+    offset = next;
+  }
+
+  if (writing && offset < st.st_size && ftruncate(fileno(pack), offset) != 0) {
+    perror("ftruncate");
+  }
+  backup->size = offset;
+}
+
+/*
+ * Open and lock the pack. If another process replaced the pack while this one
+ * waited for the lock, the new file is opened instead.
+ */
+static FILE *pack_open(struct backup *backup, int writing) {
+  for (;;) {
+    FILE *pack = fopen(backup->pack, writing ? "a+b" : "rb");
+    if (!pack) {
+      return NULL;
+    }
+    if (flock(fileno(pack), writing ? LOCK_EX : LOCK_SH) != 0) {
+      fclose(pack);
+      return NULL;
+    }
+
+    struct stat a;
+    struct stat b;
+    if (fstat(fileno(pack), &a) == 0 && stat(backup->pack, &b) == 0 && a.st_dev == b.st_dev &&
+        a.st_ino == b.st_ino) {
+      scan(backup, pack, writing);
+      return pack;
+    }
+    fclose(pack);
+  }
+}
+
+/*
+ * Hash 'text' into 'digest' and add it to the pack unless an object with that
+ * digest is already there. Returns 0 on success.
+ */
+static int put(struct backup *backup, FILE *pack, char *text, unsigned char *digest) {
+  size_t length = strlen(text);
+  sha256(text, length, digest);
+  if (lookup(backup, digest) >= 0) {
+    return 0;
+  }
+
+  uLongf size = compressBound(length);
+  unsigned char *buf = malloc(HEADER + size);
+  if (!buf || compress2(buf + HEADER, &size, (Bytef *)text, length, Z_BEST_COMPRESSION) != Z_OK) {
+    free(buf);
+    return -1;
+  }
+  memcpy(buf, digest, SHA256_LEN);
+  put32(buf + SHA256_LEN, size);
+  put32(buf + SHA256_LEN + 4, length);
+
+  int failed = fseek(pack, 0, SEEK_END) != 0 || fwrite(buf, 1, HEADER + size, pack) != HEADER + size;
+  free(buf);
+  if (failed) {
+    return -1;
+  }
+
+  insert(backup, digest, backup->size);
+  backup->size += HEADER + size;
+  return 0;
+}
+
+/*
+ * The text of an object, checked against its digest, or NULL
+ */
+static char *get(struct backup *backup, FILE *pack, unsigned char *digest) {
+  long offset = lookup(backup, digest);
+  unsigned char header[HEADER];
+  if (offset < 0 || fseek(pack, offset, SEEK_SET) != 0 || fread(header, 1, HEADER, pack) != HEADER) {
+    return NULL;
+  }
+
+  uLongf size = get32(header + SHA256_LEN);
+  uLongf length = get32(header + SHA256_LEN + 4);
+  unsigned char *buf = malloc(size + 1);
+  char *text = malloc(length + 1);
+  int ok = buf && text && fread(buf, 1, size, pack) == size &&
+           uncompress((Bytef *)text, &length, buf, size) == Z_OK;
+  free(buf);
+
+  unsigned char check[SHA256_LEN];
+  if (ok) {
+    text[length] = 0;
+    sha256(text, length, check);
+    ok = memcmp(check, digest, SHA256_LEN) == 0;
+  }
+  if (!ok) {
+    free(text);
+    return NULL;
+  }
+  return text;
+}
+
+static char *get_hex(struct backup *backup, FILE *pack, char *hex) {
+  unsigned char digest[SHA256_LEN];
+  return parse_hex(hex, digest) ? get(backup, pack, digest) : NULL;
+}
+
+/*
+ * Everything in the file except the dated entries, which are stored as blobs
+ * of their own
+ */
+static char *meta_text(cJSON *root) {
+  cJSON *meta = cJSON_CreateObject();
+  for (cJSON *node = root->child; node; node = node->next) {
+    if (!node->string) {
+      continue;
+    }
+    if (strcmp(node->string, "days") != 0) {
+      cJSON_AddItemToObject(meta, node->string, cJSON_Duplicate(node, 1));
+      continue;
+    }
+
+    cJSON *days = cJSON_CreateObject();
+    cJSON_AddItemToObject(meta, "days", days);
+    for (cJSON *child = node->child; child; child = child->next) {
+      int day;
+      if (child->string && !date_parse(child->string, &day)) {
+        cJSON_AddItemToObject(days, child->string, cJSON_Duplicate(child, 1));
+      }
+    }
+  }
+
+  char *text = cJSON_PrintUnformatted(meta);
+  cJSON_Delete(meta);
+  return text;
+}
+
+/*
+ * Store a finished month tree and name it in the manifest
+ */
+static int put_month(struct backup *backup, FILE *pack, FILE *manifest, FILE *month, char **tree, char *tag) {
+  if (fclose(month) != 0) {
+    return -1;
+  }
+
+  unsigned char digest[SHA256_LEN];
+  char hex[HEX_LEN];
+  int failed = put(backup, pack, *tree, digest) != 0;
+  free(*tree);
+  *tree = NULL;
+
+  sha256_hex(digest, hex);
+  fprintf(manifest, "month %.7s %s\n", tag, hex);
+  return failed ? -1 : 0;
+}
+
+void backup_open(struct backup *backup, char *dir) {
+  memset(backup, 0, sizeof(struct backup));
+  snprintf(backup->dir, PATH_MAX, "%s", dir);
+  snprintf(backup->pack, PATH_MAX, "%s/objects.pack", dir);
+  snprintf(backup->manifests, PATH_MAX, "%s/manifests", dir);
+  mkdir(backup->dir, 0777);
+  mkdir(backup->manifests, 0777);
+}
+
+/*
+ * Record the calendar as backup 'id', with the dated entries taken from the
+ * store and everything else from the tree. The store also remembers the digest
+ * of each day's blob between saves, so that only days that changed are hashed
+ * again. Returns 0 on success.
+ */
+int backup_save(struct backup *backup, cJSON *root, struct store *store, long id) {
+  FILE *pack = pack_open(backup, 1);
+  if (!pack) {
+    return -1;
+  }
+
+  char *text = NULL;
+  size_t size = 0;
+  FILE *manifest = open_memstream(&text, &size);
+  char *tree = NULL;
+  size_t tree_size = 0;
+  FILE *month = NULL;
+  char current[DATE_LEN] = {0};
+  char hex[HEX_LEN];
+  unsigned char digest[SHA256_LEN];
+  int failed = !manifest;
+  int days = 0;
+
+  if (!failed) {
+    char *meta = meta_text(root);
+    failed = put(backup, pack, meta, digest) != 0;
+    free(meta);
+    sha256_hex(digest, hex);
+    fprintf(manifest, MAGIC "\nmeta %s\n", hex);
+  }
+
+  for (int i = 0; i < store->rows && !failed; i++) {
+    if (!(store->flags[i] & STORE_PRESENT)) {
+      continue;
+    }
+
+    char tag[DATE_LEN];
+    date_format(store->base + i, tag);
+    if (strncmp(tag, current, 7) != 0) {
+      if (month && put_month(backup, pack, manifest, month, &tree, current) != 0) {
+        failed = 1;
+        break;
+      }
+      strcpy(current, tag);
+      month = open_memstream(&tree, &tree_size);
+      if (!month) {
+        failed = 1;
+        break;
+      }
+    }
+
+    if (!(store->flags[i] & STORE_HASHED) || lookup(backup, store->digest[i]) < 0) {
+      char *blob = store_entry_text(store, i);
+      failed = put(backup, pack, blob, store->digest[i]) != 0;
+      free(blob);
+      store->flags[i] |= STORE_HASHED;
+    }
+
+    sha256_hex(store->digest[i], hex);
+    fprintf(month, "%s %s\n", tag, hex);
+    days++;
+  }
+
+  if (month) {
+    if (failed) {
+      fclose(month);
+      free(tree);
+    } else {
+      failed = put_month(backup, pack, manifest, month, &tree, current) != 0;
+    }
+  }
+
+  if (manifest) {
+    fprintf(manifest, "days %d\n", days);
+    failed |= fclose(manifest) != 0;
+  }
+  failed = failed || fflush(pack) != 0 || fsync(fileno(pack)) != 0;
+
+  /*
+   * The manifest is only written once every object it names is on disk
+   */
+  if (!failed) {
+    char path[PATH_MAX];
+    struct atomic_file file;
+    failed = atomic_open(&file, manifest_path(backup, id, path)) != 0;
+    if (!failed) {
+      fputs(text, file.f);
+      failed = atomic_commit(&file) != 0;
+    }
+  }
+
+  if (failed) {
+    reset(backup);
+    for (int i = 0; i < store->rows; i++) {
+      store->flags[i] &= ~STORE_HASHED;
+    }
+  }
+
+  free(text);
+  fclose(pack);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Print one line per backup, oldest first. Whole-file copies left by earlier
+ * versions are listed alongside. Returns the number of backups.
+ */
+int backup_list(struct backup *backup, FILE *out) {
+  int count;
+  int legacy_count;
+  long *ids = list_ids(backup->manifests, &count);
+  long *legacy = list_ids(backup->dir, &legacy_count);
+
+  int i = 0;
+  int j = 0;
+  while (i < count || j < legacy_count) {
+    int old = i == count || (j < legacy_count && legacy[j] < ids[i]);
+    time_t t = old ? legacy[j] : ids[i];
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+
+    if (old) {
+      fprintf(out, "%ld  %s  full copy\n", legacy[j++], when);
+      continue;
+    }
+
+    char path[PATH_MAX];
+    char *text = read_text(manifest_path(backup, ids[i++], path));
+    char *days = text ? strstr(text, "\ndays ") : NULL;
+    fprintf(out, "%ld  %s  %d days\n", (long)t, when, days ? atoi(days + 6) : 0);
+    free(text);
+  }
+
+  free(ids);
+  free(legacy);
+  return count + legacy_count;
+}
+
+/*
+ * Add the days listed in a month tree to 'days'. Returns 0 on success.
+ */
+static int load_month(struct backup *backup, FILE *pack, char *hex, cJSON *days) {
+  char *tree = get_hex(backup, pack, hex);
+  if (!tree) {
+    return -1;
+  }
+
+  int failed = 0;
+  char *save;
+  for (char *line = strtok_r(tree, "\n", &save); line && !failed; line = strtok_r(NULL, "\n", &save)) {
+    char tag[DATE_LEN];
+    char blob_hex[HEX_LEN];
+    char *blob = NULL;
+    cJSON *node = NULL;
+    if (sscanf(line, "%10s %64s", tag, blob_hex) == 2 && (blob = get_hex(backup, pack, blob_hex))) {
+      node = cJSON_Parse(blob);
+    }
+    free(blob);
+    if (node) {
+      cJSON_AddItemToObject(days, tag, node);
+    } else {
+      failed = 1;
+    }
+  }
+
+  free(tree);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Reassemble backup 'id' into a tree, or return NULL if it does not exist or
+ * is damaged
+ */
+cJSON *backup_load(struct backup *backup, char *id) {
+  if (!is_id(id) || strlen(id) > 18) {
+    return NULL;
+  }
+
+  char path[PATH_MAX];
+  char *text = read_text(manifest_path(backup, strtol(id, NULL, 10), path));
+  if (!text) {
+    text = snprintf(path, PATH_MAX, "%s/%s", backup->dir, id) < PATH_MAX ? read_text(path) : NULL;
+    cJSON *root = text ? cJSON_Parse(text) : NULL;
+    free(text);
+    return root;
+  }
+
+  FILE *pack = pack_open(backup, 0);
+  cJSON *root = NULL;
+  cJSON *days = NULL;
+  int failed = !pack || strncmp(text, MAGIC "\n", strlen(MAGIC) + 1) != 0;
+
+  char *save;
+  for (char *line = strtok_r(text, "\n", &save); line && !failed; line = strtok_r(NULL, "\n", &save)) {
+    char name[8];
+    char hex[HEX_LEN];
+    if (sscanf(line, "meta %64s", hex) == 1) {
+      char *meta = get_hex(backup, pack, hex);
+      root = meta ? cJSON_Parse(meta) : NULL;
+      free(meta);
+      days = find(root, "days");
+      if (root && !days) {
+        days = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, "days", days);
+      }
+      failed = !root;
+    } else if (sscanf(line, "month %7s %64s", name, hex) == 2) {
+      failed = !days || load_month(backup, pack, hex, days) != 0;
+    }
+  }
+
+  if (pack) {
+    fclose(pack);
+  }
+  free(text);
+  if (failed) {
+    cJSON_Delete(root);
+    return NULL;
+  }
+  return root;
+}
+
+/*
+ * Whether a bucketed rule keeps backup 'id'. Backups are visited newest first,
+ * so the first one seen in a bucket is the newest in it.
+ */
+static int keep_bucket(long id, long now, long width, int buckets, long *last) {
+  long bucket = id / width;
+  if (bucket == *last || now - id >= width * buckets) {
+    return 0;
+  }
+  *last = bucket;
+  return 1;
+}
+
+/*
+ * Delete the manifests, and whole-file copies left by earlier versions, that
+ * the retention policy no longer covers. The objects they referred to are
+ * left for backup_gc(). Returns the number of backups removed.
+ */
+int backup_prune(struct backup *backup, struct retention *retention, long now) {
+  if (!retention->newest) {
+    return 0;
+  }
+
+  int count;
+  int legacy_count;
+  long *ids = list_ids(backup->manifests, &count);
+  long *legacy = list_ids(backup->dir, &legacy_count);
+
+  long hour = -1;
+  long day = -1;
+  long week = -1;
+  int seen = 0;
+  int removed = 0;
+  int i = count - 1;
+  int j = legacy_count - 1;
+  while (i >= 0 || j >= 0) {
+    int old = i < 0 || (j >= 0 && legacy[j] > ids[i]);
+    long id = old ? legacy[j--] : ids[i--];
+
+    int keep = seen++ < retention->newest || now - id < retention->recent;
+    keep |= keep_bucket(id, now, 60 * 60, retention->hours, &hour);
+    keep |= keep_bucket(id, now, 24 * 60 * 60, retention->days, &day);
+    keep |= keep_bucket(id, now, 7 * 24 * 60 * 60, retention->weeks, &week);
+    if (keep) {
+      continue;
+    }
+
+    char path[PATH_MAX];
+    if (old && snprintf(path, PATH_MAX, "%s/%ld", backup->dir, id) >= PATH_MAX) {
+      continue;
+    }
+    if (unlink(old ? path : manifest_path(backup, id, path)) == 0) {
+      removed++;
+    }
+  }
+
+  free(ids);
+  free(legacy);
+  return removed;
+}
+
+/*
+ * Mark an object as referenced. Returns 1 the first time it is seen.
+ */
+static int mark(struct backup *backup, FILE *pack, char *hex, unsigned char *live, long *used) {
+  unsigned char digest[SHA256_LEN];
+  unsigned char header[HEADER];
+  if (!parse_hex(hex, digest) || lookup(backup, digest) < 0) {
+    return 0;
+  }
+
+  unsigned int i = slot(backup, digest);
+  if (live[i]) {
+    return 0;
+  }
+  live[i] = 1;
+  if (fseek(pack, backup->offsets[i], SEEK_SET) == 0 && fread(header, 1, HEADER, pack) == HEADER) {
+    *used += HEADER + get32(header + SHA256_LEN);
+  }
+  return 1;
+}
+
+/*
+ * Drop the objects that no manifest refers to any more. The pack is only
+ * rewritten once more than half of it is unreferenced, so that removing one
+ * old backup does not copy everything else. Returns 0 on success.
+ */
+int backup_gc(struct backup *backup) {
+  FILE *pack = pack_open(backup, 1);
+  if (!pack) {
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  int count;
+  long *ids = list_ids(backup->manifests, &count);
+  unsigned char *live = calloc(backup->capacity + 1, 1);
+  long used = 0;
+  int failed = !live;
+
+  for (int n = 0; n < count && !failed; n++) {
+    char path[PATH_MAX];
+    char *text = read_text(manifest_path(backup, ids[n], path));
+    failed = !text;
+
+    char *save;
+    for (char *line = failed ? NULL : strtok_r(text, "\n", &save); line && !failed;
+         line = strtok_r(NULL, "\n", &save)) {
+      char name[8];
+      char hex[HEX_LEN];
+      if (sscanf(line, "meta %64s", hex) == 1) {
+        mark(backup, pack, hex, live, &used);
+      } else if (sscanf(line, "month %7s %64s", name, hex) == 2 && mark(backup, pack, hex, live, &used)) {
+        char *tree = get_hex(backup, pack, hex);
+        failed = !tree;
+
+        char *tree_save;
+        for (char *entry = failed ? NULL : strtok_r(tree, "\n", &tree_save); entry;
+             entry = strtok_r(NULL, "\n", &tree_save)) {
+          char tag[DATE_LEN];
+          char blob_hex[HEX_LEN];
+          if (sscanf(entry, "%10s %64s", tag, blob_hex) == 2) {
+            mark(backup, pack, blob_hex, live, &used);
+          }
+        }
+        free(tree);
+      }
+    }
+    free(text);
+  }
+
+  if (!failed && used * 2 < backup->size) {
+    struct atomic_file file;
+    if (atomic_open(&file, backup->pack) != 0) {
+      free(live);
+      free(ids);
+      fclose(pack);
+      return -1;
+    }
+
+    for (unsigned int i = 0; i < backup->capacity && !failed; i++) {
+      unsigned char header[HEADER];
+      if (!live[i] || fseek(pack, backup->offsets[i], SEEK_SET) != 0 ||
+          fread(header, 1, HEADER, pack) != HEADER) {
+        continue;
+      }
+
+      unsigned long size = get32(header + SHA256_LEN);
+      unsigned char *buf = malloc(size + 1);
+      failed = !buf || fread(buf, 1, size, pack) != size || fwrite(header, 1, HEADER, file.f) != HEADER ||
+               fwrite(buf, 1, size, file.f) != size;
+      free(buf);
+    }
+
+    if (failed) {
+      atomic_abort(&file);
+    } else {
+      failed = atomic_commit(&file) != 0;
+    }
+    reset(backup);
+    backup->inode = 0;
+  }
+
+  free(live);
+  free(ids);
+  fclose(pack);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Parse a policy given as "MINUTES,HOURS,DAYS,WEEKS". Returns 1 on success.
+ */
+int retention_parse(struct retention *retention, char *spec) {
+  int minutes;
+  int hours;
+  int days;
+  int weeks;
+  char end;
+  if (sscanf(spec, "%d,%d,%d,%d%c", &minutes, &hours, &days, &weeks, &end) != 4) {
+    return 0;
+  }
+  if (minutes < 0 || hours < 0 || days < 0 || weeks < 0) {
+    return 0;
+  }
+
+  retention->recent = minutes * 60L;
+  retention->hours = hours;
+  retention->days = days;
+  retention->weeks = weeks;
+  return 1;
+}
+
+void backup_free(struct backup *backup) {
+  free(backup->keys);
+  free(backup->offsets);
+  backup->keys = NULL;
+  backup->offsets = NULL;
+  backup->capacity = 0;
+  backup->count = 0;
+  backup->size = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+struct store;
+
+/*
+ * Backups are content addressed. Each day's entry is stored once as a
+ * compressed blob named by the SHA-256 of its text, the days of each month are
+ * listed in a tree object, and every save adds a small manifest naming the
+ * month trees and a blob with the rest of the file. Unchanged days and months
+ * are shared between backups, so a save usually costs one blob, one month tree
+ * and the manifest. Objects are appended to a single pack file so that a
+ * hundred-byte blob does not take up a filesystem block of its own.
+ */
+struct backup {
+  char dir[PATH_MAX];
+  char pack[PATH_MAX];
+  char manifests[PATH_MAX];
+
+  /*
+   * Open-addressing table from object digest to pack offset, covering the
+   * first 'size' bytes of the pack file identified by 'device' and 'inode'
+   */
+  unsigned char (*keys)[32];
+  long *offsets;
+  unsigned int capacity;
+  unsigned int count;
+  unsigned long device;
+  unsigned long inode;
+  long size;
+};
+
+/*
+ * Which backups survive pruning: every backup from the last 'recent' seconds,
+ * the newest backup in each of the last 'hours' hours, 'days' days and
+ * 'weeks' weeks, and the 'newest' most recent backups. Setting 'newest' to 0
+ * keeps everything.
+ */
+struct retention {
+  long recent;
+  int hours;
+  int days;
+  int weeks;
+  int newest;
+};
+
+void backup_open(struct backup *backup, char *dir);
+int backup_save(struct backup *backup, cJSON *root, struct store *store, long id);
+int backup_list(struct backup *backup, FILE *out);
+cJSON *backup_load(struct backup *backup, char *id);
+int backup_prune(struct backup *backup, struct retention *retention, long now);
+int backup_gc(struct backup *backup);
+int retention_parse(struct retention *retention, char *spec);
+void backup_free(struct backup *backup);
+
+#endif
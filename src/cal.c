@@ -1,42 +1,75 @@
 #include <cjson/cJSON.h>
 #include <curses.h>
-#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <locale.h>
+#include <poll.h>
 #include <regex.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
-#include <zlib.h>
+#include <unistd.h>
 
+#include "backup.h"
+#include "date.h"
+#include "file.h"
 #include "graphics.h"
+#include "grep.h"
+#include "journal.h"
+#include "json.h"
+#include "search.h"
+#include "sha256.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "store.h"
+#include "trigram.h"
 #include "util.h"
 #include "version.h"
-
-#define ONEDAY 60 * 60 * 24
+#include "watch.h"
 
 FILE *log_file;
 cJSON *cjson;
 cJSON *dates;
 cJSON *weekdays;
+struct screen screen;
+struct search search_cache;
+struct stats stats;
+struct store store;
+struct trigrams trigrams;
+struct watch watcher = {-1, ""};
+struct journal journal;
+struct backup backups;
+struct retention retention = {60 * 60, 24, 30, 52, 10};
+struct stat calendar_stat;
+cJSON *pending;
 char *backup_dir = 0;
 char *calendar_filename = 0;
 char *command = 0;
 char *home = 0;
 char *lock_location = "/tmp/termcal.lock";
+char *publish_dir = 0;
 char *log_filename = 0;
 char *text_editor = 0;
 char search_string[256] = {0};
+char socket_path[PATH_MAX] = {0};
 char status_line[256];
+char *weekday_tags[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 int calendar_view_mode = 0;
-unsigned int json_checksum = 0;
-int num_backups = 10;
+int listener = -1;
 int reg_flags = 0;
 int running = 1;
+int print_stats = 0;
+int show_stats = 0;
 int verbose = 0;
-time_t startup_time;
+unsigned long generation = 0;
+unsigned long saved_generation = 0;
+int today;
 
 struct key_mapping {
   int calendar_scroll_down;
@@ -56,13 +89,16 @@ struct key_mapping {
   int move_fast_right;
   int move_fast_up;
   int next_empty;
+  int next_match;
   int next_n;
+  int previous_match;
   int print;
   int quit;
   int reset_date_offset;
   int reverse_search;
   int save;
   int search;
+  int stats;
 } keys;
 
 #define flog(...) fprintf(log_file, ##__VA_ARGS__);
@@ -73,9 +109,37 @@ struct key_mapping {
     _set_statusline(buf);        \
   }
 
-#define redraw()                                                                                                           \
-  draw_cal_pane(w, 0, 0, calendar_scroll, date_offset, search_string, reg_flags, startup_time, dates, calendar_view_mode); \
-  draw_day_pane(w, 27, 0, date_offset, startup_time, dates, weekdays, cjson);
+/*
+ * Returned by wait_for_key() when it answered a CLI request instead
+ */
+#define REQUEST_SERVED (KEY_MAX + 1)
+
+/*
+ * Returned by wait_for_key() when another program changed the calendar file
+ */
+#define FILE_CHANGED (KEY_MAX + 2)
+
+/*
+ * Output formats of the "range" verb
+ */
+#define RANGE_TEXT 0
+#define RANGE_JSON 1
+#define RANGE_TSV 2
+
+/*
+ * Draw the regions of the screen that changed, to be sent with doupdate()
+ */
+#define redraw()                                                                                                      \
+  {                                                                                                                   \
+    struct view view = {calendar_scroll, date_offset, today, calendar_view_mode, generation != saved_generation,       \
+                        generation};                                                                                  \
+    search_set(&search_cache, search_string, reg_flags, generation);                                                  \
+    screen_layout(&screen);                                                                                           \
+    screen_draw(&screen, &view, &search_cache, status_line, &store, weekdays);                                        \
+    if (show_stats) {                                                                                                 \
+      screen_stats(&screen, &stats);                                                                                  \
+    }                                                                                                                 \
+  }
 
 /*
  * Handle ctrl-c
@@ -91,6 +155,7 @@ void resize_handler(int sig) {
   endwin();
   clear();
   refresh();
+  screen.valid = 0;
 }
 
 /*
@@ -99,53 +164,111 @@ void resize_handler(int sig) {
 void _set_statusline(char *str) { strcpy(status_line, str); }
 
 /*
- * Read a file into a cJSON struct
+ * Load a calendar file into 'store'. The file is mapped rather than read, and
+ * only the entries that are not days are parsed into the returned tree; the
+ * days are located by store_load() and decoded when they are first shown or
+ * queried. While the file is unchanged, even locating the days is skipped by
+ * loading the snapshot that was written the first time it was scanned. With
+ * 'copy' set the file is read instead, for a calendar that stays open while
+ * other programs may rewrite the file in place, which would change a mapping
+ * under the store. Returns NULL with '*error' set to the offset of the problem
+ * if the file is not valid.
  */
-cJSON *readJSONFile(FILE *f) {
-
-  char *buffer;
-
-  if (f) {
-    fseek(f, 0, SEEK_END);
-    int size = ftell(f);
-    rewind(f);
-
-    buffer = malloc(size + 1);
-    buffer[size] = 0;
-    int ret = fread(buffer, 1, size, f);
-    if (ret != size) {
-      fprintf(stderr, "Could not read the expected number of bytes.\n");
+cJSON *read_calendar(char *path, struct store *store, int copy, struct stat *st, size_t *error) {
+  char *buffer = MAP_FAILED;
+  size_t size = 0;
+  int mapped = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    if (fstat(fd, st) != 0) {
+      perror("fstat");
       exit(EXIT_FAILURE);
     }
+    size = st->st_size;
+    if (size && !copy) {
+      buffer = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      mapped = buffer != MAP_FAILED;
+    } else if (size) {
+      buffer = malloc(size + 1);
+      if (!buffer) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+      }
+      size_t done = 0;
+      ssize_t n = 1;
+      while (done < size && (n = read(fd, buffer + done, size - done)) > 0) {
+        done += n;
+      }
+      if (n < 0) {
+        perror("read");
+        exit(EXIT_FAILURE);
+      }
+      size = done;
+      buffer[size] = 0;
+    }
+    close(fd);
+  }
+
+  if (buffer != MAP_FAILED) {
+    cJSON *handle = size == (size_t)st->st_size ? snapshot_load(path, store, buffer, mapped, st) : NULL;
+    if (handle) {
+      if (verbose) {
+        fprintf(log_file, "Loaded the snapshot of \"%s\".\n", path);
+      }
+      return handle;
+    }
   } else {
-    char *template = "{\"weekdays\":{},\"days\":{}}";
-    buffer = malloc(strlen(template) + 1);
+    char *template = fd >= 0 ? "" : "{\"weekdays\":{},\"days\":{}}";
+    size = strlen(template);
+    buffer = malloc(size + 1);
     strcpy(buffer, template);
   }
 
-  cJSON *handle = cJSON_Parse(buffer);
+  int scanned = fd >= 0 && buffer[0] && size == (size_t)st->st_size;
+  cJSON *handle = store_load(store, buffer, size, mapped, error);
   if (!handle) {
-    const char *error_ptr = cJSON_GetErrorPtr();
-    if (error_ptr) {
-      fprintf(stderr, "Error before: %s\n", error_ptr);
-    }
-    cJSON_Delete(handle);
-    exit(EXIT_FAILURE);
+    store_free(store);
+    return NULL;
   }
+  if (scanned && snapshot_write(path, store, handle, st) != 0 && verbose) {
+    fprintf(log_file, "Could not write a snapshot of \"%s\": %s\n", path, strerror(errno));
+  }
+  return handle;
+}
 
-  free(buffer);
+/*
+ * Load the calendar file into the store, or exit if it is not valid
+ */
+cJSON *load_calendar(char *path, int copy) {
+  size_t error;
+  cJSON *handle = read_calendar(path, &store, copy, &calendar_stat, &error);
+  if (!handle) {
+    fprintf(stderr, "Could not parse \"%s\" near byte %zu.\n", path, error);
+    exit(EXIT_FAILURE);
+  }
   return handle;
 }
 
 void die(WINDOW *w, int no_clear, int status, char *reason) {
   if (w) {
+    screen_free(&screen);
     delwin(w);
     endwin();
     refresh();
   }
+  search_free(&search_cache);
+  watch_close(&watcher);
+  backup_free(&backups);
+  store_free(&store);
+  cJSON_Delete(pending);
   cJSON_Delete(cjson);
   fclose(log_file);
   free(calendar_filename);
+  if (listener >= 0) {
+    close(listener);
+    unlink(socket_path);
+  }
   unlink(lock_location);
 
   if (!no_clear) {
@@ -153,124 +276,631 @@ void die(WINDOW *w, int no_clear, int status, char *reason) {
   }
 
   printf("%s\n", reason);
+  if (print_stats) {
+    stats_print(&stats, stderr);
+  }
 
   exit(status);
 }
 
-int cmpfunc(const void *a, const void *b) {
-  const char *aa = *(const char **)a;
-  const char *bb = *(const char **)b;
-  return strcmp(aa, bb);
+/*
+ * Write the calendar file through a temporary file. The days come from
+ * 'store' if it is given, and from the tree otherwise. Returns 0 on success.
+ */
+int write_calendar(cJSON *root, struct store *store) {
+  struct atomic_file file;
+  if (atomic_open(&file, calendar_filename) != 0) {
+    return -1;
+  }
+
+  if (!store) {
+    json_write(file.f, root, 0);
+    return atomic_commit(&file);
+  }
+
+  fputs("{\n", file.f);
+  for (cJSON *node = root->child; node; node = node->next) {
+    json_indent(file.f, 1);
+    json_write_string(file.f, node->string);
+    fputs(":\t", file.f);
+    if (node == dates) {
+      store_write(store, file.f, dates, 1);
+    } else {
+      json_write(file.f, node, 1);
+    }
+    fputs(node->next ? ",\n" : "\n", file.f);
+  }
+  putc('}', file.f);
+  return atomic_commit(&file);
 }
 
 /*
- * Note that this method will fail briefly on Saturday November 20, 2286.
+ * Record the state that was just saved in the backup store and thin out the
+ * old backups
  */
-void remove_old_backups() {
+void take_backup() {
+  unsigned long long start = stats_clock();
+  if (backup_save(&backups, cjson, &store, time(0)) != 0) {
+    flog("Could not create a backup in \"%s\": %s\n", backup_dir, strerror(errno));
+    return;
+  }
+  snapshot_update(calendar_filename, &store, &calendar_stat);
+  stats_record(&stats, STAT_BACKUP, start);
+
+  start = stats_clock();
+  int removed = backup_prune(&backups, &retention, time(0));
+  if (verbose && removed) {
+    flog("Removed %d old backups.\n", removed);
+  }
+  if (backup_gc(&backups) != 0) {
+    flog("Could not clean up \"%s\": %s\n", backups.pack, strerror(errno));
+  }
+  stats_record(&stats, STAT_PRUNE, start);
+}
 
-  DIR *dirp = opendir(backup_dir);
-  if (!dirp) {
-    perror("opendir");
-    die(NULL, 1, EXIT_FAILURE, "Directory could not be opened.");
+/*
+ * Switch the store over to the calendar file that was just written, so that
+ * the file it was loaded from is again the one on disk, which is what a merge
+ * takes as the base both sides changed. Every day is the same as before, so
+ * the backup digests carry over.
+ */
+void resync() {
+  struct store fresh = {0};
+  struct stat st;
+  size_t error;
+  cJSON *tree = read_calendar(calendar_filename, &fresh, 1, &st, &error);
+  if (!tree) {
+    flog("Could not read back \"%s\" near byte %zu.\n", calendar_filename, error);
+    return;
   }
+  cJSON_Delete(tree);
 
-  char **dirs = malloc(sizeof(char *) * 256);
+  for (int day = store_next(&fresh, fresh.base); day != INT_MAX; day = store_next(&fresh, day + 1)) {
+    store_keep_digest(&fresh, &store, day);
+  }
+  fresh.summary.backlog = store.summary.backlog;
+  store_free(&store);
+  store = fresh;
+  calendar_stat = st;
+}
 
-  int count = 0;
-  while (count < 255) {
+/*
+ * Save data to disk. Every mutation bumps 'generation', so nothing needs to be
+ * written unless it has moved past the generation that was last saved.
+ *
+ * Routine saves only append the changes to the journal. When the journal grows
+ * too large, or 'compact' is set, the tree is instead streamed once into a
+ * temporary file, which is synced and renamed over the calendar so that a
+ * crash can never leave a partial file behind, and the journal is dropped.
+ * Either way the saved state is then added to the backup store.
+ */
+void save(int compact) {
+  if (generation == saved_generation && !(compact && journal.size)) {
+    return;
+  }
+  unsigned long long start = stats_clock();
 
-    struct dirent *d = readdir(dirp);
-    if (d == NULL) {
-      break;
+  if (!compact && journal.size < JOURNAL_LIMIT && access(calendar_filename, F_OK) == 0) {
+    if (journal_append(&journal, calendar_filename, &store, pending) == 0) {
+      store_saved(&store);
+      cJSON_Delete(pending);
+      pending = cJSON_CreateArray();
+
+      saved_generation = generation;
+      set_statusline("File saved.");
+      if (verbose) {
+        fprintf(log_file, "Appending to journal.\n");
+      }
+      take_backup();
+      stats_record(&stats, STAT_SAVE, start);
+      return;
     }
-    if (strcmp(d->d_name, ".") == 0) {
-      continue;
+    flog("Could not append to \"%s\": %s\n", journal.path, strerror(errno));
+  }
+
+  cJSON *version = find(cjson, "version");
+  if (!version) {
+    version = cJSON_CreateString(VERSION_STRING_SHORT);
+    cJSON_AddItemToObject(cjson, "version", version);
+  }
+
+  if (write_calendar(cjson, &store) != 0) {
+    flog("Could not write \"%s\": %s\n", calendar_filename, strerror(errno));
+    set_statusline("Could not save the file: %s", strerror(errno));
+    stats_record(&stats, STAT_SAVE, start);
+    return;
+  }
+
+  store_saved(&store);
+  journal_reset(&journal);
+  cJSON_Delete(pending);
+  pending = cJSON_CreateArray();
+  if (watcher.fd >= 0) {
+    resync();
+  }
+
+  saved_generation = generation;
+  set_statusline("File saved.");
+  if (verbose) {
+    fprintf(log_file, "Saving file.\n");
+  }
+
+  take_backup();
+  stats_record(&stats, STAT_SAVE, start);
+}
+
+/*
+ * A verb served for another process must not save the open calendar's own
+ * unsaved changes, which the user may still throw away. 'hold_changes' sets
+ * them aside before the verb runs, returning 0 if there are none, and
+ * 'save_verb' journals only the days the verb changed and puts them back, so
+ * that the calendar still shows them as unsaved. A day changed by both is
+ * saved as it now reads.
+ */
+int hold_changes(struct store_marks *held) {
+  if (generation == saved_generation) {
+    return 0;
+  }
+  store_hold(&store, held);
+  return 1;
+}
+
+void save_verb(struct store_marks *held, FILE *err) {
+  if (!held) {
+    save(0);
+    return;
+  }
+  if (journal_append(&journal, calendar_filename, &store, NULL) == 0) {
+    store_saved(&store);
+  } else {
+    fprintf(err, "Could not save the change, so it is left unsaved in the open calendar: %s\n", strerror(errno));
+  }
+  store_restore(&store, held);
+}
+
+/*
+ * Add a text that was just changed to the trigram index, if it is built
+ */
+void index_text(int doc, char *text) {
+  if (trigrams.built) {
+    trigram_add(&trigrams, doc, text);
+  }
+}
+
+/*
+ * The text that has an id in the trigram index, or NULL if there is none
+ */
+char *doc_text(int doc) {
+  if (doc < TRIGRAM_WEEKDAY + 7) {
+    cJSON *data = find(find(weekdays, weekday_tags[doc - TRIGRAM_WEEKDAY]), "data");
+    return data ? data->valuestring : NULL;
+  }
+  if (doc == TRIGRAM_BACKLOG) {
+    cJSON *data = find(find(cjson, "backlog"), "data");
+    return data ? data->valuestring : NULL;
+  }
+  return store_data(&store, doc);
+}
+
+/*
+ * Build the trigram index of every day, the recurring tasks and the backlog,
+ * unless it is built and fewer than a quarter of them have changed since
+ */
+void index_calendar() {
+  if (trigrams.built && trigrams.stale <= trigrams.docs / 4) {
+    return;
+  }
+
+  unsigned long long start = stats_clock();
+  trigram_free(&trigrams);
+  for (int doc = TRIGRAM_WEEKDAY; doc <= TRIGRAM_BACKLOG; doc++) {
+    char *text = doc_text(doc);
+    if (text) {
+      trigram_add(&trigrams, doc, text);
     }
-    if (strcmp(d->d_name, "..") == 0) {
-      continue;
+  }
+  for (int day = store_next(&store, store.base); day != INT_MAX; day = store_next(&store, day + 1)) {
+    char *text = store_data(&store, day);
+    if (text) {
+      trigram_add(&trigrams, day, text);
     }
-    dirs[count] = malloc(strlen(d->d_name) + 1);
-    strcpy(dirs[count], d->d_name);
-    count++;
+  }
+  trigrams.built = 1;
+  stats_record(&stats, STAT_INDEX, start);
+
+  if (verbose) {
+    fprintf(log_file, "Indexed %d texts under %d trigrams.\n", trigrams.docs, trigrams.used);
+  }
+}
+
+/*
+ * Find the texts that match a search, as ids in ascending order in '*docs' to
+ * be freed by the caller. If 'indexed' and the trigram index is built, only
+ * the candidates it gives for the pattern are tested, and every text
+ * otherwise. The days are tested by grep_days() on every processor, and their
+ * results are kept in the search for drawing.
+ */
+int find_matches(struct search *search, int indexed, int **docs) {
+  *docs = NULL;
+  if (!search->compiled) {
+    return 0;
   }
 
-  qsort(dirs, count, sizeof(char *), cmpfunc);
+  int count = -1;
+  if (indexed && trigrams.built) {
+    count = trigram_query(&trigrams, search->pattern, search->flags, docs);
+  }
+  if (count < 0) {
+    count = 0;
+    *docs = malloc((TRIGRAM_BACKLOG - TRIGRAM_WEEKDAY + 1 + store.rows) * sizeof(int));
+    if (!*docs) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    for (int doc = TRIGRAM_WEEKDAY; doc <= TRIGRAM_BACKLOG; doc++) {
+      (*docs)[count++] = doc;
+    }
+    for (int day = store_next(&store, store.base); day != INT_MAX; day = store_next(&store, day + 1)) {
+      (*docs)[count++] = day;
+    }
+  }
 
-  for (int i = 0; i < count; i++) {
-    flog("%s\n", dirs[i]);
+  int found = 0;
+  int first_day = 0;
+  while (first_day < count && (*docs)[first_day] <= TRIGRAM_BACKLOG) {
+    char *text = doc_text((*docs)[first_day]);
+    if (text && regexec(&search->preg, text, 0, NULL, 0) == 0) {
+      (*docs)[found++] = (*docs)[first_day];
+    }
+    first_day++;
   }
 
-  if (num_backups > 0) {
-    int toremove = count - num_backups;
-    if (toremove > 0) {
-      for (int i = 0; i < toremove; i++) {
-        char filename[PATH_MAX];
-        sprintf(filename, "%s/%s", backup_dir, dirs[i]);
-        flog("Removing %s\n", filename);
-        unlink(filename);
+  int *days = *docs + first_day;
+  int days_count = count - first_day;
+  int *matched;
+  int matches = grep_days(&store, days, days_count, search->pattern, search->flags, &matched);
+  if (matches < 0) {
+    for (int i = 0; i < days_count; i++) {
+      char *text = store_data(&store, days[i]);
+      if (text && search_match(search, days[i], text)) {
+        (*docs)[found++] = days[i];
       }
     }
+    return found;
+  }
+
+  int next = 0;
+  for (int i = 0; i < days_count; i++) {
+    int hit = next < matches && matched[next] == days[i];
+    next += hit;
+    search_mark(search, days[i], hit);
+    if (hit) {
+      (*docs)[found++] = days[i];
+    }
   }
+  free(matched);
+  return found;
 }
 
 /*
- * Save data to disk
+ * Move the cursor to the next day after it, or the previous one before it if
+ * 'direction' is negative, that matches the current search, wrapping around
+ * at either end
  */
-void save() {
-  {
-    char *str = cJSON_Print(cjson);
-    unsigned long crc = crc32(0L, Z_NULL, 0);
-    if (json_checksum != crc32(crc, (unsigned char *)str, strlen(str))) {
+void jump(int *date_offset, int direction) {
+  search_set(&search_cache, search_string, reg_flags, generation);
+  if (!search_cache.compiled) {
+    set_statusline("Nothing to jump to. Search with '/' first.");
+    return;
+  }
+  index_calendar();
+
+  int *docs;
+  int count = find_matches(&search_cache, 1, &docs);
+  int first = 0;
+  while (first < count && docs[first] <= TRIGRAM_BACKLOG) {
+    first++;
+  }
 
-      cJSON *version = find(cjson, "version");
-      if (!version) {
-        version = cJSON_CreateString(VERSION_STRING_SHORT);
-        cJSON_AddItemToObject(cjson, "version", version);
+  int day = today + *date_offset;
+  int target = -1;
+  if (direction > 0) {
+    for (int i = first; i < count && target < 0; i++) {
+      if (docs[i] > day) {
+        target = i;
+      }
+    }
+    if (target < 0 && first < count) {
+      target = first;
+    }
+  } else {
+    for (int i = count - 1; i >= first && target < 0; i--) {
+      if (docs[i] < day) {
+        target = i;
       }
-      char *str = cJSON_Print(cjson);
+    }
+    if (target < 0 && first < count) {
+      target = count - 1;
+    }
+  }
 
-      FILE *f = fopen(calendar_filename, "wb");
-      fprintf(f, "%s", str);
-      fclose(f);
+  if (target < 0) {
+    set_statusline("No day matches \"%.200s\".", search_cache.pattern);
+  } else {
+    *date_offset = docs[target] - today;
+    set_statusline("Match %d of %d for \"%.200s\".", target - first + 1, count - first, search_cache.pattern);
+  }
+  free(docs);
+}
 
-      /*
-       * Backups
-       */
-      char backup_filename[PATH_MAX];
-      bzero(backup_filename, PATH_MAX);
-      sprintf(backup_filename, "%s/%lu", backup_dir, time(0));
+/*
+ * Merge one text that is not a day, 'tag' of 'parent' in the open calendar,
+ * given what the file had and has now. Returns 1 if the file's change was
+ * taken, 2 if both sides changed it differently and the open calendar kept its
+ * own, and 0 otherwise.
+ */
+int merge_text(cJSON *parent, char *tag, cJSON *base, cJSON *theirs) {
+  cJSON *node = find(find(parent, tag), "data");
+  char *ours = cJSON_IsString(node) ? node->valuestring : NULL;
+  char *before = cJSON_IsString(base) ? base->valuestring : NULL;
+  char *after = cJSON_IsString(theirs) ? theirs->valuestring : NULL;
+
+  if (before && after ? strcmp(before, after) == 0 : before == after) {
+    return 0;
+  }
+  if (ours && after ? strcmp(ours, after) == 0 : ours == after) {
+    return 0;
+  }
+  if (ours && before ? strcmp(ours, before) != 0 : ours != before) {
+    return 2;
+  }
 
-      f = fopen(backup_filename, "wb");
-      fprintf(f, "%s", str);
-      fclose(f);
+  if (after) {
+    set_data(parent, tag, after);
+  } else {
+    cJSON_DeleteItemFromObject(parent, tag);
+  }
+  return 1;
+}
+
+/*
+ * Merge what another program changed in the calendar file into the open
+ * calendar. Each day, recurring task and the backlog is compared between the
+ * file as it was last loaded or written, the file now, and the open calendar.
+ * A change on one side only is kept, and where both sides changed something
+ * differently the open calendar keeps its version, which is reported as a
+ * conflict. Days are compared by their bytes in the two files first, so only
+ * the ones written differently there are decoded.
+ *
+ * The store then moves over to the new file, with the days the open calendar
+ * still has its own version of marked as changes. Changes that were saved to
+ * the journal were made against the old file, so they are written out in full.
+ */
+void merge_file() {
+  struct stat st;
+  if (stat(calendar_filename, &st) != 0) {
+    set_statusline("The calendar file was removed. Saving writes it again.");
+    return;
+  }
+  if (st.st_dev == calendar_stat.st_dev && st.st_ino == calendar_stat.st_ino && st.st_size == calendar_stat.st_size &&
+      st.st_mtim.tv_sec == calendar_stat.st_mtim.tv_sec && st.st_mtim.tv_nsec == calendar_stat.st_mtim.tv_nsec) {
+    return;
+  }
+  unsigned long long start = stats_clock();
+
+  struct store theirs = {0};
+  size_t error;
+  cJSON *tree = read_calendar(calendar_filename, &theirs, 1, &st, &error);
+  if (!tree || !find(tree, "days") || !find(tree, "weekdays")) {
+    cJSON_Delete(tree);
+    store_free(&theirs);
+    set_statusline("The calendar file changed but is not a valid calendar. Keeping the open one.");
+    return;
+  }
 
-      free(str);
-      {
-        char *str = cJSON_Print(cjson);
-        unsigned long crc = crc32(0L, Z_NULL, 0);
-        json_checksum = crc32(crc, (unsigned char *)str, strlen(str));
-        free(str);
+  /*
+   * The file as it was is parsed again from the store's copy of it
+   */
+  struct store base = {0};
+  char *copy = malloc(store.source_size + 1);
+  if (!copy) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(copy, store.source, store.source_size);
+  cJSON *base_tree = store_load(&base, copy, store.source_size, 0, &error);
+
+  int taken = 0;
+  int conflicts = 0;
+  char first_conflict[DATE_LEN] = "";
+  int day = store.base;
+  if (theirs.rows && theirs.base < day) {
+    day = theirs.base;
+  }
+  if (base.rows && base.base < day) {
+    day = base.base;
+  }
+  while (1) {
+    int next = store_next(&theirs, day);
+    int ours_next = store_next(&store, day);
+    int base_next = store_next(&base, day);
+    next = ours_next < next ? ours_next : next;
+    next = base_next < next ? base_next : next;
+    if (next == INT_MAX) {
+      break;
+    }
+    day = next;
+
+    int row = store_row(&store, day);
+    int flags = row >= 0 ? store.flags[row] : 0;
+    int base_row = store_row(&base, day);
+    int changed_here = !(flags & STORE_RAW) && (flags & STORE_PRESENT || (base_row >= 0 && base.flags[base_row] & STORE_PRESENT));
+    int changed_there = !store_same_source(&base, &theirs, day) && !store_equal(&base, &theirs, day);
+
+    if (!changed_here && changed_there) {
+      taken++;
+      char *text = store_data(&theirs, day);
+      index_text(day, text ? text : "");
+    } else if (!changed_here) {
+      store_keep_digest(&theirs, &store, day);
+    } else if (!changed_there || !store_equal(&store, &theirs, day)) {
+      if (changed_there) {
+        char tag[DATE_LEN];
+        date_format(day, tag);
+        flog("Kept the open version of %s, which was also changed in \"%s\".\n", tag, calendar_filename);
+        if (!conflicts++) {
+          strcpy(first_conflict, tag);
+        }
       }
-      set_statusline("File saved.");
-      if (verbose) {
-        fprintf(log_file, "Saving file.\n");
+      store_copy(&theirs, &store, day);
+    }
+    day++;
+  }
+
+  for (int i = 0; i < 7; i++) {
+    cJSON *before = find(find(find(base_tree, "weekdays"), weekday_tags[i]), "data");
+    cJSON *after = find(find(find(tree, "weekdays"), weekday_tags[i]), "data");
+    int merged = merge_text(weekdays, weekday_tags[i], before, after);
+    if (merged == 1) {
+      taken++;
+      char *text = doc_text(TRIGRAM_WEEKDAY + i);
+      index_text(TRIGRAM_WEEKDAY + i, text ? text : "");
+    } else if (merged == 2) {
+      flog("Kept the open version of %s, which was also changed in \"%s\".\n", weekday_tags[i], calendar_filename);
+      if (!conflicts++) {
+        strcpy(first_conflict, weekday_tags[i]);
+      }
+    }
+  }
+  int merged = merge_text(cjson, "backlog", find(find(base_tree, "backlog"), "data"), find(find(tree, "backlog"), "data"));
+  if (merged == 1) {
+    taken++;
+    char *text = doc_text(TRIGRAM_BACKLOG);
+    index_text(TRIGRAM_BACKLOG, text ? text : "");
+  } else if (merged == 2) {
+    flog("Kept the open version of the backlog, which was also changed in \"%s\".\n", calendar_filename);
+    if (!conflicts++) {
+      strcpy(first_conflict, "backlog");
+    }
+  }
+
+  cJSON *backlog = find(find(cjson, "backlog"), "data");
+  theirs.summary.backlog = backlog ? count_lines(backlog->valuestring) : 0;
+  store_free(&store);
+  store = theirs;
+  calendar_stat = st;
+  cJSON_Delete(tree);
+  cJSON_Delete(base_tree);
+  store_free(&base);
+  int saved = generation == saved_generation;
+  generation++;
+  if (saved) {
+    saved_generation = generation;
+  }
+
+  if (journal.size) {
+    save(1);
+  }
+  stats_record(&stats, STAT_MERGE, start);
+
+  if (conflicts) {
+    set_statusline("Merged %d changes from the file. Kept your version of %d changed on both sides, first %s.", taken,
+                   conflicts, first_conflict);
+  } else if (taken) {
+    set_statusline("Merged %d changes from the file.", taken);
+  }
+  if (verbose) {
+    flog("Merged %d changes from \"%s\" with %d conflicts.\n", taken, calendar_filename, conflicts);
+  }
+}
+
+/*
+ * Append every line read from 'in' to the calendar. A line that starts with a
+ * date tag goes to that day; every other line goes to the next of the days
+ * 'first', 'first + increment', and so on. Blank lines are skipped. The days
+ * that had no text before are counted in '*created' and the rest in
+ * '*appended'.
+ */
+void import(FILE *in, int first, int increment, int *created, int *appended) {
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  int next = first;
+
+  while ((length = getline(&line, &capacity, in)) >= 0) {
+    while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      line[--length] = 0;
+    }
+
+    char tag[DATE_LEN];
+    char *text = line;
+    int day;
+    if (length >= DATE_LEN - 1 && (line[DATE_LEN - 1] == ' ' || line[DATE_LEN - 1] == '\t' || !line[DATE_LEN - 1])) {
+      memcpy(tag, line, DATE_LEN - 1);
+      tag[DATE_LEN - 1] = 0;
+      if (date_parse(tag, &day)) {
+        text = line + strspn(line + DATE_LEN - 1, " \t") + DATE_LEN - 1;
       }
+    }
+    if (!*text || strspn(text, " \t") == strlen(text)) {
+      continue;
+    }
+    if (text == line) {
+      day = next;
+      next += increment;
+    }
 
-      remove_old_backups();
+    char *data = store_data(&store, day);
+    if (data) {
+      (*appended)++;
+    } else {
+      (*created)++;
+      data = "";
     }
-    free(str);
+
+    char *buf = malloc(strlen(data) + strlen(text) + 2);
+    sprintf(buf, "%s%s\n", data, text);
+    store_set_data(&store, day, buf);
+    index_text(day, buf);
+    free(buf);
   }
+  free(line);
 }
 
 /*
- * Run the command specified by the user
+ * Open some text in the chosen text editor and return the edited version,
+ * which must be freed by the caller
  */
-void print() {
-  if (!command) {
-    system("./print.sh");
-  } else {
-    system(command);
+char *edit_text(char *text) {
+  mkdir("/tmp/terminal-calendar/", 0777);
+  char filename[] = "/tmp/terminal-calendar/cal.XXXXXX";
+  int tmpfd = mkstemp(filename);
+  FILE *tmpfile = fdopen(tmpfd, "wb");
+  fprintf(tmpfile, "%s", text);
+  fclose(tmpfile);
+
+  char command[256];
+  sprintf(command, "%s %s", text_editor, filename);
+  unsigned long long start = stats_clock();
+  system(command);
+  stats_record(&stats, STAT_EDIT, start);
+  screen_invalidate(&screen);
+
+  tmpfile = fopen(filename, "rb");
+  fseek(tmpfile, 0, SEEK_END);
+  int size = ftell(tmpfile);
+  rewind(tmpfile);
+
+  char *buffer = malloc(size + 1);
+  buffer[size] = 0;
+  int ret = fread(buffer, 1, size, tmpfile);
+  if (ret != size) {
+    fprintf(stderr, "Could not read the expected number of bytes.\n");
+    exit(EXIT_FAILURE);
   }
+  fclose(tmpfile);
+
+  return buffer;
 }
 
 /*
@@ -285,51 +915,779 @@ void edit_date(cJSON *node, char *tag) {
   if (!root) {
     root = cJSON_CreateObject();
     cJSON_AddItemToObject(node, tag, root);
+    generation++;
+  }
+
+  cJSON *day_data = find(root, "data");
+  if (!day_data) {
+    day_data = cJSON_CreateString("");
+    cJSON_AddItemToObject(root, "data", day_data);
+    generation++;
+  }
+
+  char *buffer = edit_text(day_data->valuestring);
+  if (strcmp(buffer, day_data->valuestring) != 0) {
+    if (node == cjson) {
+      store.summary.backlog = count_lines(buffer);
+      cJSON_AddItemToArray(pending, journal_text("backlog", NULL, buffer));
+      index_text(TRIGRAM_BACKLOG, buffer);
+    } else {
+      cJSON_AddItemToArray(pending, journal_text("weekday", tag, buffer));
+      for (int i = 0; i < 7; i++) {
+        if (strcmp(tag, weekday_tags[i]) == 0) {
+          index_text(TRIGRAM_WEEKDAY + i, buffer);
+        }
+      }
+    }
+    cJSON_DeleteItemFromObject(root, "data");
+    day_data = cJSON_CreateString(buffer);
+    cJSON_AddItemToObject(root, "data", day_data);
+    generation++;
+  }
+  free(buffer);
+}
+
+/*
+ * Edit the text for a day with the chosen text editor
+ */
+void edit_day(int day) {
+  char tag[DATE_LEN];
+  date_format(day, tag);
+  if (verbose) {
+    fprintf(log_file, "Editing tag \"%s\".\n", tag);
+  }
+
+  char *data = store_data(&store, day);
+  char *buffer = edit_text(data ? data : "");
+  if (!data || strcmp(buffer, data) != 0) {
+    store_set_data(&store, day, buffer);
+    index_text(day, buffer);
+    generation++;
+  }
+  free(buffer);
+}
+
+/*
+ * Read a whole stream into a buffer to be freed by the caller
+ */
+char *slurp(FILE *in, size_t *size) {
+  char *text = NULL;
+  FILE *f = open_memstream(&text, size);
+  if (!f) {
+    perror("open_memstream");
+    exit(EXIT_FAILURE);
+  }
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    fwrite(chunk, 1, n, f);
   }
+  fclose(f);
+  return text;
+}
 
-  if (root) {
-    cJSON *day_data = find(root, "data");
-    if (!day_data) {
-      day_data = cJSON_CreateString("");
-      cJSON_AddItemToObject(root, "data", day_data);
+/*
+ * Write 'length' bytes of text as a TSV field, with backslashes, tabs and line
+ * breaks escaped
+ */
+void write_field(FILE *out, const char *text, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    switch (text[i]) {
+    case '\\':
+      fputs("\\\\", out);
+      break;
+    case '\t':
+      fputs("\\t", out);
+      break;
+    case '\n':
+      fputs("\\n", out);
+      break;
+    case '\r':
+      fputs("\\r", out);
+      break;
+    default:
+      putc(text[i], out);
     }
+  }
+}
 
-    mkdir("/tmp/terminal-calendar/", 0777);
-    char filename[] = "/tmp/terminal-calendar/cal.XXXXXX";
-    int tmpfd = mkstemp(filename);
-    FILE *tmpfile = fdopen(tmpfd, "wb");
-    if (day_data) {
-      fprintf(tmpfile, "%s", day_data->valuestring);
+/*
+ * Write the lines of a recurring entry, each marked as checked off or not by
+ * the bits of 'mask'. Blank lines are skipped and do not take a bit, as on
+ * screen.
+ */
+void write_recurring(FILE *out, int format, char *text, int mask) {
+  int n = 0;
+  for (char *line = text; *line; line++) {
+    size_t length = strcspn(line, "\n");
+    if (length) {
+      n++;
+      int done = mask >> n & 1;
+      if (format == RANGE_JSON) {
+        char copy[length + 1];
+        memcpy(copy, line, length);
+        copy[length] = 0;
+        fprintf(out, "%s{\"text\":", n > 1 ? "," : "");
+        json_write_string(out, copy);
+        fprintf(out, ",\"done\":%s}", done ? "true" : "false");
+      } else if (format == RANGE_TSV) {
+        fprintf(out, "%s%c ", n > 1 ? "\\n" : "", done ? '+' : 'o');
+        write_field(out, line, length);
+      } else {
+        fprintf(out, "%c %.*s\n", done ? '+' : 'o', (int)length, line);
+      }
+    }
+    line += length;
+    if (!*line) {
+      break;
     }
-    fclose(tmpfile);
+  }
+}
 
-    char command[256];
-    sprintf(command, "%s %s", text_editor, filename);
-    system(command);
+/*
+ * Write the days from 'from' to 'to' in date order. Each day is written as
+ * soon as it is read from the store, and texts that are still escaped in the
+ * file are copied as they are into JSON or decoded into a scratch buffer, so
+ * a range of any length is written without building a tree of it or growing
+ * the store. With 'weekly' set the recurring entry of each day's weekday is
+ * added, with the lines checked off that day marked, and days that have only
+ * a recurring entry are written too.
+ */
+void export_range(FILE *out, int from, int to, int format, int weekly) {
+  char *recurring[7] = {NULL};
+  for (int i = 0; weekly && i < 7; i++) {
+    cJSON *data = find(find(weekdays, weekday_tags[i]), "data");
+    if (cJSON_IsString(data) && data->valuestring[0]) {
+      recurring[i] = data->valuestring;
+    }
+  }
+
+  char *scratch = NULL;
+  size_t capacity = 0;
+  for (int day = from; day <= to; day++) {
+    int next = store_next(&store, day);
+    for (int d = day; weekly && d < next && d < day + 7; d++) {
+      if (recurring[date_weekday(d)]) {
+        next = d;
+      }
+    }
+    if (next > to) {
+      break;
+    }
+    day = next;
+
+    int row = store_row(&store, day);
+    int flags = row >= 0 ? store.flags[row] : 0;
+    int mask = flags & STORE_MASK ? store.mask[row] : 0;
+    char *weekday = weekday_tags[date_weekday(day)];
+    char *weekly_text = recurring[date_weekday(day)];
+    char tag[DATE_LEN];
+    date_format(day, tag);
+
+    if (format == RANGE_JSON) {
+      fprintf(out, "{\"date\":\"%s\",\"weekday\":\"%s\"", tag, weekday);
+      if (flags & STORE_ENCODED) {
+        fprintf(out, ",\"data\":\"%.*s\"", store.raw_length[row], store.source + store.raw[row]);
+      } else if (flags & STORE_DATA) {
+        fputs(",\"data\":", out);
+        json_write_string(out, store.arena + store.offset[row]);
+      }
+      if (flags & STORE_MASK) {
+        fprintf(out, ",\"mask\":%d", mask);
+      }
+      if (weekly_text) {
+        fputs(",\"recurring\":[", out);
+        write_recurring(out, format, weekly_text, mask);
+        putc(']', out);
+      }
+      fputs("}\n", out);
+      continue;
+    }
+
+    char *text = store_peek(&store, day, &scratch, &capacity);
+    if (!text) {
+      text = "";
+    }
+    size_t length = strlen(text);
+    if (format == RANGE_TSV) {
+      fprintf(out, "%s\t%s\t%d\t", tag, weekday, mask);
+      write_field(out, text, length);
+      if (weekly) {
+        putc('\t', out);
+        if (weekly_text) {
+          write_recurring(out, format, weekly_text, mask);
+        }
+      }
+      putc('\n', out);
+    } else {
+      fprintf(out, "%s %s\n%s%s", tag, weekday, text, length && text[length - 1] != '\n' ? "\n" : "");
+      if (weekly_text) {
+        fputs("Recurring Weekly\n", out);
+        write_recurring(out, format, weekly_text, mask);
+      }
+      putc('\n', out);
+    }
+  }
+  free(scratch);
+}
+
+/*
+ * Write 'text' to 'path' by way of a temporary file renamed over it, so that a
+ * web server never hands out half of it. Returns 0 on success.
+ */
+int publish_file(char *path, char *text, size_t size) {
+  char temporary[PATH_MAX];
+  if (snprintf(temporary, PATH_MAX, "%s.tmp", path) >= PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  FILE *f = fopen(temporary, "wb");
+  if (!f) {
+    return -1;
+  }
+  int failed = fwrite(text, 1, size, f) != size;
+  failed |= fclose(f) != 0;
+  if (failed || rename(temporary, path) != 0) {
+    unlink(temporary);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Write the calendar into 'dir' for the web page in public/: the days of each
+ * month as JSON lines in data/YYYY-MM.jsonl, and manifest.json with the
+ * recurring tasks and a hash per month. A month's hash is taken over the day
+ * numbers and digests of its days, which the store and its snapshot keep for
+ * the backups, so finding the months that changed decodes no text. Only the
+ * months whose hash differs from the one in the previous manifest are written,
+ * and the months that no longer have any days are removed. Returns 0 on
+ * success, with the numbers of months written and removed.
+ */
+int publish(char *dir, int *written, int *removed) {
+  *written = 0;
+  *removed = 0;
+
+  char path[PATH_MAX + 32];
+  char data_dir[PATH_MAX];
+  if (snprintf(data_dir, PATH_MAX, "%s/data", dir) >= PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if ((mkdir(dir, 0777) != 0 && errno != EEXIST) || (mkdir(data_dir, 0777) != 0 && errno != EEXIST)) {
+    return -1;
+  }
 
-    tmpfile = fopen(filename, "rb");
-    fseek(tmpfile, 0, SEEK_END);
-    int size = ftell(tmpfile);
-    rewind(tmpfile);
+  snprintf(path, sizeof(path), "%s/manifest.json", dir);
+  char *previous = NULL;
+  size_t previous_size = 0;
+  FILE *f = fopen(path, "rb");
+  if (f) {
+    previous = slurp(f, &previous_size);
+    fclose(f);
+  }
+  cJSON *old = previous ? cJSON_Parse(previous) : NULL;
+  cJSON *old_months = find(old, "months");
+
+  cJSON *manifest = cJSON_CreateObject();
+  cJSON *recurring = cJSON_CreateObject();
+  cJSON_AddItemToObject(manifest, "weekdays", recurring);
+  for (int i = 0; i < 7; i++) {
+    cJSON *data = find(find(weekdays, weekday_tags[i]), "data");
+    if (cJSON_IsString(data)) {
+      cJSON_AddStringToObject(recurring, weekday_tags[i], data->valuestring);
+    }
+  }
+  cJSON *months = cJSON_CreateObject();
+  cJSON_AddItemToObject(manifest, "months", months);
+
+  int failed = 0;
+  int day = store_next(&store, store.base);
+  while (day != INT_MAX && !failed) {
+    int year, month, mday;
+    civil_from_days(day, &year, &month, &mday);
+    int first = days_from_civil(year, month, 1);
+    int next = month == 12 ? days_from_civil(year + 1, 1, 1) : days_from_civil(year, month + 1, 1);
+
+    char *listing = NULL;
+    size_t size = 0;
+    FILE *list = open_memstream(&listing, &size);
+    if (!list) {
+      perror("open_memstream");
+      exit(EXIT_FAILURE);
+    }
+    for (; day < next; day = store_next(&store, day + 1)) {
+      int row = day - store.base;
+      if (!(store.flags[row] & STORE_HASHED)) {
+        char *blob = store_entry_text(&store, row);
+        sha256(blob, strlen(blob), store.digest[row]);
+        free(blob);
+        store.flags[row] |= STORE_HASHED;
+      }
+      fwrite(&day, sizeof(day), 1, list);
+      fwrite(store.digest[row], SHA256_LEN, 1, list);
+    }
+    fclose(list);
+
+    unsigned char digest[SHA256_LEN];
+    char hex[2 * SHA256_LEN + 1];
+    char tag[DATE_LEN];
+    sha256(listing, size, digest);
+    free(listing);
+    sha256_hex(digest, hex);
+    date_format(first, tag);
+    tag[7] = 0;
+    cJSON_AddStringToObject(months, tag, hex);
+
+    snprintf(path, sizeof(path), "%s/%s.jsonl", data_dir, tag);
+    cJSON *known = find(old_months, tag);
+    if (cJSON_IsString(known) && strcmp(known->valuestring, hex) == 0 && access(path, F_OK) == 0) {
+      continue;
+    }
 
-    char buffer[size + 1];
-    buffer[size] = 0;
-    int ret = fread(buffer, 1, size, tmpfile);
-    if (ret != size) {
-      fprintf(stderr, "Could not read the expected number of bytes.\n");
+    char *shard = NULL;
+    FILE *out = open_memstream(&shard, &size);
+    if (!out) {
+      perror("open_memstream");
       exit(EXIT_FAILURE);
     }
+    export_range(out, first, next - 1, RANGE_JSON, 0);
+    fclose(out);
+    failed = publish_file(path, shard, size) != 0;
+    free(shard);
+    *written += !failed;
+  }
 
-    cJSON_DeleteItemFromObject(root, "data");
-    day_data = cJSON_CreateString(buffer);
-    cJSON_AddItemToObject(root, "data", day_data);
+  /*
+   * The old manifest is only trusted to name files that could be shards
+   */
+  for (cJSON *month = old_months ? old_months->child : NULL; month; month = month->next) {
+    char tag[DATE_LEN];
+    int first;
+    int valid = month->string && strlen(month->string) == 7 &&
+                snprintf(tag, DATE_LEN, "%s-01", month->string) == DATE_LEN - 1 && date_parse(tag, &first);
+    if (!failed && valid && !find(months, month->string)) {
+      snprintf(path, sizeof(path), "%s/%s.jsonl", data_dir, month->string);
+      *removed += unlink(path) == 0;
+    }
+  }
+
+  char *text = cJSON_PrintUnformatted(manifest);
+  if (!failed && (!previous || strcmp(text, previous) != 0)) {
+    snprintf(path, sizeof(path), "%s/manifest.json", dir);
+    failed = publish_file(path, text, strlen(text)) != 0;
+  }
+  free(text);
+  free(previous);
+  cJSON_Delete(old);
+  cJSON_Delete(manifest);
+  snapshot_update(calendar_filename, &store, &calendar_stat);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Publish the calendar if --publish was given, then run the command specified
+ * by the user
+ */
+void print() {
+  int written;
+  int removed;
+  if (publish_dir && publish(publish_dir, &written, &removed) != 0) {
+    flog("Could not publish to \"%s\": %s\n", publish_dir, strerror(errno));
+    set_statusline("Could not publish to \"%s\": %s", publish_dir, strerror(errno));
+  } else if (publish_dir && verbose) {
+    flog("Published %d changed months to \"%s\" and removed %d.\n", written, publish_dir, removed);
+  }
+
+  if (!command) {
+    system("./print.sh");
+  } else {
+    system(command);
+  }
+  screen_invalidate(&screen);
+}
+
+/*
+ * Run a CLI verb on the loaded calendar. 'argv' holds the verb's arguments,
+ * output goes to 'out' and errors to 'err', and "import" reads from 'in' when
+ * it is not given a file. Used both for --cli and for requests that arrive on
+ * the server socket.
+ */
+void run_verb(char *verb, int argc, char *argv[], FILE *in, FILE *out, FILE *err) {
+  if (strcmp(verb, "print") == 0) {
+    if (argc > 0) {
+      int i = 0;
+      while (i < argc) {
+        int day;
+        char *data = NULL;
+        if (date_parse(argv[i], &day)) {
+          data = store_data(&store, day);
+        }
+        if (data) {
+          fprintf(out, "%s\n", data);
+        } else {
+          fprintf(err, "Tag (%s) not found.\n", argv[i]);
+        }
+        i++;
+      }
+    }
+  }
+
+  if (strcmp(verb, "append") == 0) {
+    if (argc == 2) {
+      int day;
+      if (date_parse(argv[0], &day)) {
+        struct store_marks held;
+        int holding = hold_changes(&held);
+        char *data = store_data(&store, day);
+        if (!data) {
+          data = "";
+        }
+
+        char buf[strlen(data) + strlen(argv[1]) + 2];
+        sprintf(buf, "%s%s\n", data, argv[1]);
+        store_set_data(&store, day, buf);
+        index_text(day, buf);
+
+        fprintf(out, "%s\n", buf);
+        generation++;
+        save_verb(holding ? &held : NULL, err);
+      } else {
+        fprintf(err, "Tag (%s) is not a date.\n", argv[0]);
+      }
+    } else {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    }
+  }
+
+  if (strcmp(verb, "days") == 0) {
+    int from;
+    int to;
+    if (argc != 2) {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    } else if (!date_parse(argv[0], &from)) {
+      fprintf(err, "Tag (%s) is not a date.\n", argv[0]);
+    } else if (!date_parse(argv[1], &to)) {
+      fprintf(err, "Tag (%s) is not a date.\n", argv[1]);
+    } else {
+      for (int day = store_next(&store, from); day <= to; day = store_next(&store, day + 1)) {
+        int row = day - store.base;
+        char tag[DATE_LEN];
+        date_format(day, tag);
+        fprintf(out, "%s\t%d\n", tag, store.flags[row] & (STORE_DATA | STORE_ENCODED) ? store.lines[row] : 0);
+      }
+    }
+  }
+
+  if (strcmp(verb, "range") == 0) {
+    int format = RANGE_TEXT;
+    int weekly = 0;
+    int i = 0;
+    while (i < argc - 2 && (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "-w") == 0)) {
+      if (argv[i][1] == 'w') {
+        weekly = 1;
+      } else {
+        format = argv[i][1] == 'j' ? RANGE_JSON : RANGE_TSV;
+      }
+      i++;
+    }
+
+    int from;
+    int to;
+    if (argc - i != 2) {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    } else if (!date_parse(argv[i], &from)) {
+      fprintf(err, "Tag (%s) is not a date.\n", argv[i]);
+    } else if (!date_parse(argv[i + 1], &to)) {
+      fprintf(err, "Tag (%s) is not a date.\n", argv[i + 1]);
+    } else {
+      export_range(out, from, to, format, weekly);
+    }
+  }
+
+  if (strcmp(verb, "import") == 0) {
+    char *source = argc > 0 ? argv[0] : "-";
+    long offset = 1;
+    long increment = 1;
+    FILE *f = NULL;
+
+    if (argc > 3) {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    } else if (1 < argc && !parse_number(argv[1], &offset)) {
+      fprintf(err, "Offset (%s) is not a number.\n", argv[1]);
+    } else if (2 < argc && !parse_number(argv[2], &increment)) {
+      fprintf(err, "Increment (%s) is not a number.\n", argv[2]);
+    } else if (!(f = strcmp(source, "-") == 0 ? in : fopen(source, "rb"))) {
+      fprintf(err, "Could not read \"%s\": %s\n", source, strerror(errno));
+    } else {
+      int created = 0;
+      int appended = 0;
+      struct store_marks held;
+      int holding = hold_changes(&held);
+      import(f, date_today() + offset, increment, &created, &appended);
+      if (f != in) {
+        fclose(f);
+      }
+      if (created || appended) {
+        generation++;
+        save_verb(holding ? &held : NULL, err);
+      } else if (holding) {
+        store_restore(&store, &held);
+      }
+      fprintf(out, "Created %d and appended to %d entries.\n", created, appended);
+    }
+  }
+
+  /*
+   * "grep" is "search" without the trigram index, always testing every entry
+   */
+  if (strcmp(verb, "search") == 0 || strcmp(verb, "grep") == 0) {
+    int indexed = verb[0] == 's';
+    int flags = 0;
+    int literal = 0;
+    int i = 0;
+    while (i < argc - 1 && (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-F") == 0)) {
+      if (argv[i][1] == 'i') {
+        flags |= REG_ICASE;
+      } else {
+        literal = 1;
+      }
+      i++;
+    }
+
+    if (argc - i != 1) {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    } else {
+      char *pattern = argv[i];
+      char escaped[2 * strlen(pattern) + 1];
+      if (literal) {
+        char *p = escaped;
+        for (char *c = pattern; *c; c++) {
+          if (strchr(".[]*^$\\", *c)) {
+            *p++ = '\\';
+          }
+          *p++ = *c;
+        }
+        *p = 0;
+        pattern = escaped;
+      }
+
+      struct search query = {0};
+      search_set(&query, pattern, flags, generation);
+      if (!query.compiled) {
+        fprintf(err, "Pattern (%s) is not a valid regular expression.\n", argv[i]);
+      } else {
+        /*
+         * Building the index only pays off for a calendar that stays loaded
+         */
+        if (indexed && listener >= 0) {
+          index_calendar();
+        }
+
+        int *docs;
+        int count = find_matches(&query, indexed, &docs);
+        for (int j = 0; j < count; j++) {
+          char tag[DATE_LEN];
+          if (docs[j] < TRIGRAM_WEEKDAY + 7) {
+            strcpy(tag, weekday_tags[docs[j] - TRIGRAM_WEEKDAY]);
+          } else if (docs[j] == TRIGRAM_BACKLOG) {
+            strcpy(tag, "backlog");
+          } else {
+            date_format(docs[j], tag);
+          }
+
+          char *text = doc_text(docs[j]);
+          regmatch_t match;
+          regexec(&query.preg, text, 1, &match, 0);
+          char *line = text + match.rm_so;
+          while (line > text && line[-1] != '\n') {
+            line--;
+          }
+          fprintf(out, "%s\t%.*s\n", tag, (int)strcspn(line, "\n"), line);
+        }
+        free(docs);
+      }
+      search_free(&query);
+    }
+  }
+
+  if (strcmp(verb, "publish") == 0) {
+    char *dir = argc > 0 ? argv[0] : publish_dir ? publish_dir : "public";
+    int written;
+    int removed;
+    if (argc > 1) {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    } else if (publish(dir, &written, &removed) != 0) {
+      fprintf(err, "Could not publish to \"%s\": %s\n", dir, strerror(errno));
+    } else {
+      fprintf(out, "Wrote %d and removed %d months in \"%s\".\n", written, removed, dir);
+    }
+  }
+
+  if (strcmp(verb, "backups") == 0) {
+    if (backup_list(&backups, out) == 0) {
+      fprintf(err, "No backups found in \"%s\".\n", backup_dir);
+    }
+  }
+
+  if (strcmp(verb, "restore") == 0) {
+    if (argc == 1) {
+      cJSON *restored = backup_load(&backups, argv[0]);
+      if (access(lock_location, F_OK) == 0) {
+        fprintf(err, "Found a lock file (%s). Close the calendar before restoring.\n", lock_location);
+      } else if (!restored) {
+        fprintf(err, "Backup (%s) not found.\n", argv[0]);
+      } else if (backup_save(&backups, cjson, &store, time(0)) != 0) {
+        fprintf(err, "Could not back up the current calendar: %s\n", strerror(errno));
+      } else if (write_calendar(restored, NULL) != 0) {
+        fprintf(err, "Could not write \"%s\": %s\n", calendar_filename, strerror(errno));
+      } else {
+        journal_reset(&journal);
+        fprintf(out, "Restored backup %s.\n", argv[0]);
+      }
+      cJSON_Delete(restored);
+    } else {
+      fprintf(err, "Wrong number of arguments specified.\n");
+    }
+  }
+}
+
+/*
+ * Hand a CLI verb to the server or open calendar that holds the lock on this
+ * calendar file. The input of "import" is read here, as the server cannot open
+ * the client's files, and is passed back in '*input' in case the verb has to
+ * be run locally after all. A lock file or socket that belongs to another user
+ * is ignored, as anyone can create one in /tmp. Returns 0 if the verb was
+ * answered by the lock's owner, and 1 if it is the lock owner's to answer but
+ * was not answered.
+ */
+int forward(char *verb, int argc, char *argv[], char **input, size_t *input_size) {
+  char calendar[PATH_MAX];
+  char owner[PATH_MAX + 1] = {0};
+  char path[PATH_MAX + 1] = {0};
+  FILE *lock = fopen(lock_location, "rb");
+  if (!lock) {
+    return -1;
+  }
+  struct stat st;
+  int mine = fstat(fileno(lock), &st) == 0 && st.st_uid == getuid();
+  int named = mine && fgets(owner, sizeof(owner), lock) && fgets(path, sizeof(path), lock);
+  fclose(lock);
+  owner[strcspn(owner, "\n")] = 0;
+  path[strcspn(path, "\n")] = 0;
+  if (!named || !realpath(calendar_filename, calendar) || strcmp(owner, calendar) != 0) {
+    return -1;
+  }
+  if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+    return -1;
+  }
+
+  char *args[argc + 2];
+  args[0] = verb;
+  memcpy(args + 1, argv, argc * sizeof(char *));
+  if (strcmp(verb, "import") == 0) {
+    char *source = argc > 0 ? argv[0] : "-";
+    FILE *f = strcmp(source, "-") == 0 ? stdin : fopen(source, "rb");
+    if (!f) {
+      fprintf(stderr, "Could not read \"%s\": %s\n", source, strerror(errno));
+      return 1;
+    }
+    *input = slurp(f, input_size);
+    if (f != stdin) {
+      fclose(f);
+    }
+    args[1] = "-";
+    argc = argc ? argc : 1;
+  }
+
+  /*
+   * The server runs in its own directory, so the directory to publish to is
+   * made absolute here
+   */
+  char directory[PATH_MAX + 1];
+  char cwd[PATH_MAX];
+  if (strcmp(verb, "publish") == 0 && argc > 0 && argv[0][0] != '/' && getcwd(cwd, sizeof(cwd)) &&
+      snprintf(directory, sizeof(directory), "%s/%s", cwd, argv[0]) < (int)sizeof(directory)) {
+    args[1] = directory;
+  }
+  return server_forward(path, argc + 1, args, *input, *input_size, stdout, stderr);
+}
+
+/*
+ * Create the lock file and start listening for CLI requests next to it. The
+ * lock names the calendar file and the socket, which is how --cli finds them.
+ */
+void take_lock() {
+  if (snprintf(socket_path, PATH_MAX, "%s.sock", lock_location) < PATH_MAX) {
+    listener = server_listen(socket_path);
+  }
+  if (listener < 0) {
+    flog("Could not listen on \"%s\": %s\n", socket_path, strerror(errno));
+  }
+
+  char calendar[PATH_MAX];
+  FILE *tclock = fopen(lock_location, "wb");
+  if (listener >= 0 && realpath(calendar_filename, calendar)) {
+    fprintf(tclock, "%s\n%s\n", calendar, socket_path);
+  }
+  fclose(tclock);
+}
+
+/*
+ * Answer one CLI request waiting on the socket
+ */
+void serve() {
+  struct request request;
+  if (server_accept(listener, &request) != 0) {
+    return;
+  }
+  if (verbose) {
+    flog("Answering \"%s\" from the command line.\n", request.argv[0]);
+  }
+  run_verb(request.argv[0], request.argc - 1, request.argv + 1, request.in, request.out, request.err);
+  server_reply(&request);
+}
+
+/*
+ * Wait for the next keypress, answering CLI requests in the meantime. Returns
+ * REQUEST_SERVED after a request so that the screen can be redrawn, and
+ * FILE_CHANGED when the calendar file may have been changed by another
+ * program.
+ */
+int wait_for_key(WINDOW *w) {
+  if (listener < 0 && watcher.fd < 0) {
+    return getch();
+  }
+
+  nodelay(w, TRUE);
+  int c = getch();
+  nodelay(w, FALSE);
+  if (c != ERR) {
+    return c;
+  }
+
+  while (1) {
+    struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {listener, POLLIN, 0}, {watcher.fd, POLLIN, 0}};
+    if (poll(fds, 3, -1) < 0) {
+      return ERR;
+    }
+    if (fds[1].revents & POLLIN) {
+      serve();
+      return REQUEST_SERVED;
+    }
+    if (fds[2].revents & POLLIN && watch_changed(&watcher)) {
+      return FILE_CHANGED;
+    }
+    if (fds[0].revents) {
+      return getch();
+    }
   }
 }
 
 void usage(char *argv[]) {
   fprintf(stderr,
           "Usage: %s [options]\n"
-          " -b,--num_backups The number of backup files to keep (default 10). Specify 0 for unlimited files.\n"
+          " -b,--num_backups The number of newest backups always kept (default 10). Specify 0 for unlimited backups.\n"
           " -c,--command     The command to be run when \"printing\" (default `./print.sh`).\n"
           " -d,--backup_dir  The directory to store backup files in (default ~/.terminal_calendar_backup/).\n"
           " -e,--editor      The command representing the text editor to use (default vim).\n"
@@ -338,6 +1696,11 @@ void usage(char *argv[]) {
           " -l,--log-file    The name of the log file to be used.\n"
           " -n,--no-clear    Do not clear the screen on shutdown.\n"
           " -o,--lock-file   The name of the lock file to be used (default /tmp/termcal.lock).\n"
+          " -p,--publish     Write the calendar into this directory for the web page before \"printing\".\n"
+          " -s,--server      Keep the calendar loaded without a screen and answer --cli requests.\n"
+          " -t,--stats       Print how long loading, drawing, saving and editing took on exit.\n"
+          " -r,--retention   Keep every backup from the last MINUTES, then one per hour, day and week for\n"
+          "                  the given number of each, as MINUTES,HOURS,DAYS,WEEKS (default 60,24,30,52).\n"
           " -v,--verbose     Display additional logging information.\n"
           " -V,--version     Display the software version and exit.\n"
           "",
@@ -351,14 +1714,9 @@ void usage(char *argv[]) {
  */
 void search(WINDOW *w, int calendar_scroll, int date_offset, int flags, char symbol) {
   reg_flags = flags;
-  int width;
-  int height;
-  getmaxyx(w, height, width);
-  width = width;
-  height = height;
-  move(height - 1, 0);
-  printw("%c", symbol);
   search_string[0] = 0;
+  screen_prompt(&screen, symbol, search_string);
+  doupdate();
   while (1) {
     int i = strlen(search_string);
     search_string[i + 1] = 0;
@@ -372,17 +1730,14 @@ void search(WINDOW *w, int calendar_scroll, int date_offset, int flags, char sym
         break;
       }
       search_string[i - 1] = 0;
-    } else {
+    } else if (i < (int)sizeof(search_string) - 2) {
       search_string[i] = c;
     }
 
     redraw();
-    move(height - 1, 0);
-    printw("%c", symbol);
-    move(height - 1, 1);
-    printw(search_string);
+    screen_prompt(&screen, symbol, search_string);
+    doupdate();
   }
-  refresh();
 }
 
 /*
@@ -450,17 +1805,23 @@ int main(int argc, char *argv[]) {
   keys.move_right = 'l';
   keys.move_up = 'k';
   keys.next_empty = 'n';
+  keys.next_match = ']';
   keys.next_n = 'N';
+  keys.previous_match = '[';
   keys.print = 'p';
   keys.quit = 'q';
   keys.reset_date_offset = '0';
   keys.reverse_search = 92; // Backslash
   keys.save = 's';
   keys.search = '/';
+  keys.stats = 'T';
 
   int no_clear = 0;
   int cli_mode = 0;
+  int server_mode = 0;
   char *cli_arg = NULL;
+  char *input = NULL;
+  size_t input_size = 0;
 
   text_editor = getenv("EDITOR");
   home = getenv("HOME");
@@ -470,7 +1831,7 @@ int main(int argc, char *argv[]) {
    */
   int opt;
   int option_index = 0;
-  char *optstring = "b:d:c:e:f:hl:no:vz:V";
+  char *optstring = "+b:d:c:e:f:hl:no:p:r:stvz:V";
   static struct option long_options[] = {
       {"cli", required_argument, 0, 'z'},
       {"backup_dir", required_argument, 0, 'd'},
@@ -482,6 +1843,10 @@ int main(int argc, char *argv[]) {
       {"log-file", required_argument, 0, 'l'},
       {"no-clear", no_argument, 0, 'n'},
       {"num_backups", required_argument, 0, 'b'},
+      {"publish", required_argument, 0, 'p'},
+      {"retention", required_argument, 0, 'r'},
+      {"server", no_argument, 0, 's'},
+      {"stats", no_argument, 0, 't'},
       {"verbose", no_argument, 0, 'v'},
       {"version", no_argument, 0, 'V'},
       {0, 0, 0, 0},
@@ -489,7 +1854,7 @@ int main(int argc, char *argv[]) {
 
   while ((opt = getopt_long(argc, argv, optstring, long_options, &option_index)) != -1) {
     if (opt == 'b') {
-      num_backups = atoi(optarg);
+      retention.newest = atoi(optarg);
     } else if (opt == 'c') {
       command = malloc(strlen(optarg) + 1);
       strcpy(command, optarg);
@@ -512,15 +1877,34 @@ int main(int argc, char *argv[]) {
     } else if (opt == 'o') {
       lock_location = malloc(strlen(optarg) + 1);
       strcpy(lock_location, optarg);
+    } else if (opt == 'p') {
+      publish_dir = malloc(strlen(optarg) + 1);
+      strcpy(publish_dir, optarg);
+    } else if (opt == 'r') {
+      if (!retention_parse(&retention, optarg)) {
+        usage(argv);
+      }
+    } else if (opt == 's') {
+      server_mode = 1;
+    } else if (opt == 't') {
+      print_stats = 1;
     } else if (opt == 'v') {
       verbose = 1;
     } else if (opt == 'V') {
       print_version();
       exit(EXIT_SUCCESS);
     } else if (opt == 'z') {
+      /*
+       * Everything after the verb is its own, including arguments that look
+       * like options of the program, such as "range -t"
+       */
       cli_mode = 1;
       cli_arg = malloc(strlen(optarg) + 1);
       strcpy(cli_arg, optarg);
+      if (optind < argc && strcmp(argv[optind], "--") == 0) {
+        optind++;
+      }
+      break;
     } else if (opt == '?') {
       usage(argv);
     } else {
@@ -561,7 +1945,19 @@ int main(int argc, char *argv[]) {
     sprintf(backup_dir, "%s/%s", home, f);
   }
 
-  mkdir(backup_dir, 0777);
+  /*
+   * Let the server or open calendar that owns this calendar answer CLI verbs,
+   * which spares loading it here and keeps the two from writing it at once
+   */
+  int forwarded = cli_mode ? forward(cli_arg, argc - optind, argv + optind, &input, &input_size) : -1;
+  if (forwarded >= 0) {
+    free(input);
+    fclose(log_file);
+    free(calendar_filename);
+    return forwarded ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  backup_open(&backups, backup_dir);
 
   /*
    * Open the appropriate save file and read it into a cJSON struct
@@ -569,17 +1965,11 @@ int main(int argc, char *argv[]) {
   if (verbose) {
     fprintf(log_file, "Using \"%s\" as save file.\n", calendar_filename);
   }
-  FILE *f = fopen(calendar_filename, "rb");
-  cjson = readJSONFile(f);
-  if (f) {
-    fclose(f);
-  }
-
-  char *str = cJSON_Print(cjson);
-  unsigned long crc = crc32(0L, Z_NULL, 0);
-  json_checksum = crc32(crc, (unsigned char *)str, strlen(str));
-  free(str);
+  unsigned long long start = stats_clock();
+  cjson = load_calendar(calendar_filename, !cli_mode);
+  stats_record(&stats, STAT_LOAD, start);
 
+  start = stats_clock();
   cJSON *version = find(cjson, "version");
   if (version) {
     char *p = version->valuestring;
@@ -604,6 +1994,7 @@ int main(int argc, char *argv[]) {
       }
     }
   }
+  stats_record(&stats, STAT_VERSION, start);
 
   dates = find(cjson, "days");
   weekdays = find(cjson, "weekdays");
@@ -613,66 +2004,43 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  if (cli_mode) {
-    if (strcmp(cli_arg, "print") == 0) {
-      if (optind < argc) {
-        int i = optind;
-        while (i < argc) {
-          cJSON *tag = find(dates, argv[i]);
-          if (tag) {
-            cJSON *data = find(tag, "data");
-            fprintf(stdout, "%s\n", data->valuestring);
-          } else {
-            fprintf(stderr, "Tag (%s) not found.\n", argv[i]);
-          }
-          i++;
-        }
-      }
-    }
-
-    if (strcmp(cli_arg, "append") == 0) {
-      if (argc - optind == 2) {
-        cJSON *tag = find(dates, argv[optind]);
-
-        if (!tag) {
-          tag = cJSON_CreateObject();
-          cJSON_AddItemToObject(dates, argv[optind], tag);
-        }
 
-        if (tag) {
-          cJSON *data = find(tag, "data");
-          if (!data) {
-            char *str = malloc(strlen(argv[optind + 1]) + 2);
-            if (!str) {
-              perror("malloc");
-            }
-
-            sprintf(str, "%s\n", argv[optind + 1]);
-            data = cJSON_CreateString(str);
-            cJSON_AddItemToObject(tag, "data", data);
-            free(str);
-          } else {
-            char buf[strlen(data->valuestring) + strlen(argv[optind + 1]) + 2];
-            sprintf(buf, "%s%s\n", data->valuestring, argv[optind + 1]);
-            cJSON_DeleteItemFromObject(tag, "data");
-            cJSON *new_data = cJSON_CreateString(buf);
-            cJSON_AddItemToObject(tag, "data", new_data);
-          }
+  pending = cJSON_CreateArray();
+  int changed;
+  int replayed = journal_replay(&journal, calendar_filename, cjson, &store, &changed);
+  if (replayed < 0) {
+    fprintf(log_file, "\"%s\" is not a journal and was moved aside.\n", journal.path);
+  } else if (changed) {
+    fprintf(log_file, "\"%s\" changed since its journal was started. Applied the %d journal records over it.\n",
+            calendar_filename, replayed);
+  } else if (verbose && replayed) {
+    fprintf(log_file, "Replayed %d journal records.\n", replayed);
+  }
 
-          fprintf(stdout, "%s\n", data->valuestring);
-          save();
-        }
-      } else {
-        fprintf(stderr, "Wrong number of arguments specified.\n");
-      }
+  if (cli_mode) {
+    FILE *in = input_size ? fmemopen(input, input_size, "r") : stdin;
+    run_verb(cli_arg, argc - optind, argv + optind, in ? in : stdin, stdout, stderr);
+    if (in && in != stdin) {
+      fclose(in);
     }
-
+    free(input);
+    if (print_stats) {
+      stats_print(&stats, stderr);
+    }
+    store_free(&store);
+    backup_free(&backups);
+    cJSON_Delete(pending);
     cJSON_Delete(cjson);
     fclose(log_file);
     free(calendar_filename);
     return EXIT_SUCCESS;
   }
 
+  cJSON *backlog = find(find(cjson, "backlog"), "data");
+  if (backlog) {
+    store.summary.backlog = count_lines(backlog->valuestring);
+  }
+
   /*
    * Create a lock to prevent multiple use
    */
@@ -680,8 +2048,41 @@ int main(int argc, char *argv[]) {
     printf("Found a lock file (%s). Another instance of this program may be running.\n", lock_location);
     exit(EXIT_FAILURE);
   } else {
-    FILE *tclock = fopen(lock_location, "wb");
-    fclose(tclock);
+    take_lock();
+  }
+
+  if (watch_open(&watcher, calendar_filename) != 0 && verbose) {
+    fprintf(log_file, "Could not watch \"%s\" for changes.\n", calendar_filename);
+  }
+
+  if (server_mode) {
+    if (listener < 0) {
+      die(NULL, 1, EXIT_FAILURE, "Could not start the server.");
+    }
+
+    struct sigaction act;
+    bzero(&act, sizeof(struct sigaction));
+    act.sa_sigaction = sig_term_handler;
+    act.sa_flags = SA_SIGINFO;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+
+    if (verbose) {
+      fprintf(log_file, "Listening on \"%s\".\n", socket_path);
+    }
+    while (running) {
+      struct pollfd fds[2] = {{listener, POLLIN, 0}, {watcher.fd, POLLIN, 0}};
+      if (poll(fds, 2, -1) > 0) {
+        if (fds[0].revents & POLLIN) {
+          serve();
+        }
+        if (fds[1].revents & POLLIN && watch_changed(&watcher)) {
+          merge_file();
+        }
+      }
+    }
+    save(1);
+    die(NULL, 1, EXIT_SUCCESS, "Server stopped.");
   }
 
   /*
@@ -690,6 +2091,7 @@ int main(int argc, char *argv[]) {
   if (verbose) {
     fprintf(log_file, "Initializing ncurses.\n");
   }
+  start = stats_clock();
   WINDOW *w;
   if ((w = initscr()) == NULL) {
     fprintf(stderr, "Error initializing ncurses.\n");
@@ -714,6 +2116,7 @@ int main(int argc, char *argv[]) {
   init_pair(6, COLOR_BLACK, COLOR_YELLOW);
   init_pair(7, COLOR_BLACK, COLOR_RED);
   init_pair(8, COLOR_MAGENTA, COLOR_BLACK);
+  stats_record(&stats, STAT_CURSES, start);
 
   /*
    * Handle signals
@@ -730,10 +2133,7 @@ int main(int argc, char *argv[]) {
 
   int calendar_scroll = 4;
   int date_offset = 0;
-  startup_time = time(0);
-  struct tm *now = localtime(&startup_time);
-  now->tm_hour = 12;
-  startup_time = mktime(now);
+  today = date_today();
 
   /*
    * Main Loop
@@ -742,30 +2142,23 @@ int main(int argc, char *argv[]) {
     fprintf(log_file, "Displaying calendar.\n");
   }
   int c = 0;
+  unsigned long long frame = stats_clock();
   while (1) {
 
-    time_t selected_day = startup_time + date_offset * ONEDAY;
-    struct tm *selected = localtime(&selected_day);
-
-    char tag[256];
-    strftime(tag, 256, "%Y-%m-%d", selected);
+    char tag[DATE_LEN];
+    date_format(today + date_offset, tag);
 
     set_statusline(" ");
 
     if (c >= '1' && c <= '9') {
       int num = c - '0';
-      cJSON *root = find(dates, tag);
-      if (root) {
-        cJSON *mask = find(root, "mask");
-        if (!mask) {
-          cJSON *number = cJSON_CreateNumber(0);
-          cJSON_AddItemToObject(root, "mask", number);
-          mask = find(root, "mask");
-        }
-        int value = mask->valueint;
+      int row = store_row(&store, today + date_offset);
+      if (row >= 0 && store.flags[row] & STORE_PRESENT) {
+        int value = store.mask[row];
         int maskdiff = 1 << num;
         value ^= maskdiff;
-        cJSON_SetNumberHelper(mask, value);
+        store_set_mask(&store, today + date_offset, value);
+        generation++;
       }
     } else if (c == keys.reset_date_offset) {
       date_offset = 0;
@@ -775,11 +2168,15 @@ int main(int argc, char *argv[]) {
       if (verbose) {
         fprintf(log_file, "Deleting calendar entry.\n");
       }
-      cJSON_DeleteItemFromObject(dates, tag);
+      int row = store_row(&store, today + date_offset);
+      if (row >= 0 && store.flags[row] & STORE_PRESENT) {
+        store_remove(&store, today + date_offset);
+        generation++;
+      }
       set_statusline("Deleted entry \"%s\".", tag);
     } else if (c == keys.edit_recurring) {
       char *days_short[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-      edit_date(weekdays, days_short[selected->tm_wday]);
+      edit_date(weekdays, days_short[date_weekday(today + date_offset)]);
     } else if (c == keys.move_left) {
       date_offset--;
     } else if (c == keys.move_down) {
@@ -797,65 +2194,31 @@ int main(int argc, char *argv[]) {
     } else if (c == keys.move_fast_right) {
       date_offset += 3;
     } else if (c == keys.next_empty) {
-      while (1) {
-        time_t s = startup_time + date_offset * ONEDAY;
-        struct tm *sel = localtime(&s);
-        char t[256];
-        strftime(t, 256, "%Y-%m-%d", sel);
-        cJSON *root = find(dates, t);
-        if (!root) {
-          break;
-        }
-        date_offset++;
-      }
+      date_offset = store_next_free(&store, today + date_offset) - today;
     } else if (c == keys.next_n) {
-      while (1) {
-        time_t s = startup_time + date_offset * ONEDAY;
-        struct tm *sel = localtime(&s);
-        char t[256];
-        strftime(t, 256, "%Y-%m-%d", sel);
-        cJSON *root = find(dates, t);
-        if (!root) {
-          break;
-        }
-        if (root) {
-          cJSON *day_data = find(root, "data");
-          if (day_data) {
-            int count = 0;
-            for (int i = 0; i < strlen(day_data->valuestring); i++) {
-              if (day_data->valuestring[i] == '\n') {
-                count++;
-              }
-            }
-            if (count < 4) {
-              break;
-            }
-          }
-        }
-        date_offset++;
-      }
+      date_offset = store_next_short(&store, today + date_offset) - today;
+    } else if (c == keys.next_match) {
+      jump(&date_offset, 1);
+    } else if (c == keys.previous_match) {
+      jump(&date_offset, -1);
     } else if (c == keys.save) {
-      save();
+      save(0);
     } else if (c == keys.print) {
-      save();
+      save(1);
       print();
     } else if (c == keys.edit_date) {
-      edit_date(dates, tag);
+      edit_day(today + date_offset);
     } else if (c == keys.cycle_mode) {
       calendar_view_mode++;
       if (calendar_view_mode > 2) {
         calendar_view_mode = 0;
       }
     } else if (c == keys.quit) {
-      {
-        char *str = cJSON_Print(cjson);
-        unsigned long crc = crc32(0L, Z_NULL, 0);
-        if (json_checksum != crc32(crc, (unsigned char *)str, strlen(str))) {
-          set_statusline("Refusing to quit (you have unsaved data). Save with \"s\", or quit with \"ctrl-c\".");
-        } else {
-          running = 0;
-        }
-        free(str);
+      if (generation != saved_generation) {
+        set_statusline("Refusing to quit (you have unsaved data). Save with \"s\", or quit with \"ctrl-c\".");
+      } else {
+        save(1);
+        running = 0;
       }
     } else if (c == keys.search) {
       search(w, calendar_scroll, date_offset, 0, '/');
@@ -865,10 +2228,20 @@ int main(int argc, char *argv[]) {
       clear();
       draw_help();
       getch();
+      screen_invalidate(&screen);
+    } else if (c == keys.stats) {
+      show_stats = !show_stats;
+      screen.valid = 0;
     } else if (c == keys.calendar_scroll_down) {
       calendar_scroll++;
     } else if (c == keys.calendar_scroll_up) {
       calendar_scroll--;
+    } else if (c == FILE_CHANGED) {
+      merge_file();
+    } else if (c == REQUEST_SERVED) {
+      /*
+       * Only redraw, as a CLI request may have changed the calendar
+       */
     } else {
       flog("Uncaught keypress: %d\n", c);
     }
@@ -890,25 +2263,21 @@ int main(int argc, char *argv[]) {
       break;
     }
 
+    stats_record(&stats, STAT_INPUT, frame);
+
     /*
      * Display the left and right panes
      */
+    start = stats_clock();
     redraw();
-
-    {
-      char *str = cJSON_Print(cjson);
-      unsigned long crc = crc32(0L, Z_NULL, 0);
-      if (json_checksum != crc32(crc, (unsigned char *)str, strlen(str))) {
-        move(0, 0);
-        printw("(*)");
-      }
-      free(str);
-    }
-
-    draw_statusline(w, status_line);
-
-    refresh();
-    c = getch();
+    stats_record(&stats, STAT_REDRAW, start);
+    start = stats_clock();
+    doupdate();
+    stats_record(&stats, STAT_REFRESH, start);
+    stats_record(&stats, STAT_FRAME, frame);
+
+    c = wait_for_key(w);
+    frame = stats_clock();
   }
 
   if (verbose) {
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "date.h"
+
+/*
+ * Convert a proleptic Gregorian date to a day number. Years are shifted to
+ * start in March so that the leap day falls at the end of the year, and are
+ * grouped into 400 year eras of 146097 days.
+ */
+int days_from_civil(int year, int month, int day) {
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  unsigned int yoe = year - era * 400;
+  unsigned int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int)doe - 719468;
+}
+
+/*
+ * The inverse of 'days_from_civil'
+ */
+void civil_from_days(int days, int *year, int *month, int *day) {
+  days += 719468;
+  int era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned int doe = days - era * 146097;
+  unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned int mp = (5 * doy + 2) / 153;
+
+  *day = doy - (153 * mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+  *year = (int)yoe + era * 400 + (*month <= 2);
+}
+
+/*
+ * Day of the week, where Sunday is 0. Day 0 was a Thursday.
+ */
+int date_weekday(int days) {
+  return days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6;
+}
+
+/*
+ * Day of the year, starting from 1
+ */
+int date_yday(int days) {
+  int year, month, day;
+  civil_from_days(days, &year, &month, &day);
+  return days - days_from_civil(year, 1, 1) + 1;
+}
+
+/*
+ * Week of the year, where weeks start on Sunday and days before the first
+ * Sunday are in week 0. This is the same as strftime's "%U".
+ */
+int date_week(int days) {
+  return (date_yday(days) - 1 + 7 - date_weekday(days)) / 7;
+}
+
+/*
+ * Write the "YYYY-MM-DD" tag for a day into 'buf', which must hold DATE_LEN
+ * bytes
+ */
+void date_format(int days, char *buf) {
+  int year, month, day;
+  civil_from_days(days, &year, &month, &day);
+
+  if (year < 0 || year > 9999) {
+    snprintf(buf, DATE_LEN, "%d-%2.2d-%2.2d", year, month, day);
+    return;
+  }
+
+  buf[0] = '0' + year / 1000;
+  buf[1] = '0' + year / 100 % 10;
+  buf[2] = '0' + year / 10 % 10;
+  buf[3] = '0' + year % 10;
+  buf[4] = '-';
+  buf[5] = '0' + month / 10;
+  buf[6] = '0' + month % 10;
+  buf[7] = '-';
+  buf[8] = '0' + day / 10;
+  buf[9] = '0' + day % 10;
+  buf[10] = 0;
+}
+
+/*
+ * Parse a "YYYY-MM-DD" tag. Returns 1 and sets 'days' if the string is exactly
+ * a valid date, and 0 otherwise.
+ */
+int date_parse(char *str, int *days) {
+  int fields[3] = {0};
+  int widths[3] = {4, 2, 2};
+
+  for (int f = 0; f < 3; f++) {
+    for (int i = 0; i < widths[f]; i++) {
+      if (*str < '0' || *str > '9') {
+        return 0;
+      }
+      fields[f] = fields[f] * 10 + *str++ - '0';
+    }
+    if (*str != (f < 2 ? '-' : 0)) {
+      return 0;
+    }
+    str++;
+  }
+
+  int year = fields[0];
+  int month = fields[1];
+  int day = fields[2];
+  if (month < 1 || month > 12 || day < 1) {
+    return 0;
+  }
+
+  int n = days_from_civil(year, month, day);
+  int y, m, d;
+  civil_from_days(n, &y, &m, &d);
+  if (m != month) {
+    return 0;
+  }
+
+  *days = n;
+  return 1;
+}
+
+/*
+ * The current local date as a day number
+ */
+int date_today() {
+  time_t now = time(0);
+  struct tm *tm = localtime(&now);
+  return days_from_civil(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+}
@@ -0,0 +1,19 @@
+#ifndef DATE_H
+#define DATE_H
+
+/*
+ * Dates are represented as day numbers counted from 1970-01-01. A formatted
+ * "YYYY-MM-DD" tag needs DATE_LEN bytes including the terminator.
+ */
+#define DATE_LEN 11
+
+int days_from_civil(int year, int month, int day);
+void civil_from_days(int days, int *year, int *month, int *day);
+int date_weekday(int days);
+int date_yday(int days);
+int date_week(int days);
+void date_format(int days, char *buf);
+int date_parse(char *str, int *days);
+int date_today();
+
+#endif
@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file.h"
+
+#define BUFFER_SIZE (1 << 16)
+
+/*
+ * Start writing 'path'. Symbolic links are followed so that the link itself is
+ * not replaced, and the permissions of an existing file are kept. Returns 0 on
+ * success.
+ */
+int atomic_open(struct atomic_file *file, char *path) {
+  if (!realpath(path, file->path)) {
+    snprintf(file->path, PATH_MAX, "%s", path);
+  }
+  if (strlen(file->path) + strlen(".XXXXXX") >= PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(file->tmp, file->path);
+  strcat(file->tmp, ".XXXXXX");
+
+  int fd = mkstemp(file->tmp);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (stat(file->path, &st) == 0) {
+    fchmod(fd, st.st_mode & 07777);
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+
+  file->f = fdopen(fd, "wb");
+  if (!file->f) {
+    close(fd);
+    unlink(file->tmp);
+    return -1;
+  }
+  setvbuf(file->f, NULL, _IOFBF, BUFFER_SIZE);
+  return 0;
+}
+
+/*
+ * Flush the file to disk and move it into place. The containing directory is
+ * synced as well so that the rename itself survives a crash. Returns 0 on
+ * success; on failure the temporary file is removed and the original is left
+ * as it was.
+ */
+int atomic_commit(struct atomic_file *file) {
+  int failed = ferror(file->f) || fflush(file->f) != 0 || fsync(fileno(file->f)) != 0;
+  failed |= fclose(file->f) != 0;
+  file->f = NULL;
+
+  if (failed || rename(file->tmp, file->path) != 0) {
+    unlink(file->tmp);
+    return -1;
+  }
+
+  char dir[PATH_MAX];
+  snprintf(dir, PATH_MAX, "%s", file->path);
+  int fd = open(dirname(dir), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return 0;
+}
+
+void atomic_abort(struct atomic_file *file) {
+  if (file->f) {
+    fclose(file->f);
+    file->f = NULL;
+  }
+  unlink(file->tmp);
+}
@@ -0,0 +1,18 @@
+#ifndef FILE_H
+#define FILE_H
+
+/*
+ * A file that is written under a temporary name and renamed into place once it
+ * is complete, so readers only ever see the old or the new contents
+ */
+struct atomic_file {
+  FILE *f;
+  char path[PATH_MAX];
+  char tmp[PATH_MAX];
+};
+
+int atomic_open(struct atomic_file *file, char *path);
+int atomic_commit(struct atomic_file *file);
+void atomic_abort(struct atomic_file *file);
+
+#endif
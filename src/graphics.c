@@ -4,20 +4,23 @@
 #include <regex.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
+#include "date.h"
+#include "graphics.h"
+#include "search.h"
+#include "stats.h"
+#include "store.h"
 #include "util.h"
 
-#define ONEDAY 60 * 60 * 24
-
 char *months_short[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+char *days_short[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
 
 /*
  * Print text, respecting newlines, and coloring the text based on the
  * 1-character signifier at the beginning of the line
  */
-int print_multiline(char *str, int rootx, int rooty, int width, int height) {
+int print_multiline(WINDOW *w, char *str, int rootx, int rooty, int width, int height) {
 
   char *data = malloc(strlen(str) + 1);
   strcpy(data, str);
@@ -34,31 +37,30 @@ int print_multiline(char *str, int rootx, int rooty, int width, int height) {
     if (ptr[i] == '\n' || ptr[i] == 0) {
       ptr[i] = 0;
       if (ptr[0] == '+') {
-        color_set(2, NULL);
-        attron(A_BOLD);
+        wcolor_set(w, 2, NULL);
+        wattron(w, A_BOLD);
       }
       if (ptr[0] == 'o') {
-        color_set(3, NULL);
-        attron(A_BOLD);
+        wcolor_set(w, 3, NULL);
+        wattron(w, A_BOLD);
       }
       if (ptr[0] == '-') {
-        color_set(4, NULL);
-        attron(A_BOLD);
+        wcolor_set(w, 4, NULL);
+        wattron(w, A_BOLD);
       }
       if (ptr[0] == 'x') {
-        color_set(5, NULL);
-        attron(A_BOLD);
+        wcolor_set(w, 5, NULL);
+        wattron(w, A_BOLD);
       }
       if (strlen(ptr) > width) {
         ptr[width] = 0;
       }
       if (line < height || height == 0) {
-        move(rooty + line, rootx);
-        printw("%s", ptr);
+        mvwprintw(w, rooty + line, rootx, "%s", ptr);
       }
       lines++;
-      color_set(0, NULL);
-      attroff(A_BOLD);
+      wcolor_set(w, 0, NULL);
+      wattroff(w, A_BOLD);
 
       ptr += i + 1;
       i = 0;
@@ -78,79 +80,46 @@ int print_multiline(char *str, int rootx, int rooty, int width, int height) {
 }
 
 /*
- * Print the right pane, with the data for that day
+ * Print the top of the right pane, with the data for that day
  */
-void draw_day_pane(WINDOW *w, int rootx, int rooty, int date_offset, time_t startup_time, cJSON *dates, cJSON *weekdays, cJSON *cjson) {
+void draw_day_pane(WINDOW *w, int date_offset, int today, struct store *store) {
+
+  int selected = today + date_offset;
+  int year, month, day;
+  civil_from_days(selected, &year, &month, &day);
+
+  char tag[DATE_LEN];
+  date_format(selected, tag);
 
-  time_t selected_day = startup_time + date_offset * ONEDAY;
-  struct tm *selected = localtime(&selected_day);
   char buf[256];
-  strftime(buf, 256, "%a %d %b %Y (%Y-%m-%d) Week %-U, Day %-j", selected);
+  sprintf(buf, "%s %2.2d %s %d (%s) Week %d, Day %d", days_short[date_weekday(selected)], day,
+          months_short[month - 1], year, tag, date_week(selected), date_yday(selected));
 
-  move(rooty, rootx);
-  printw("%s", buf);
+  mvwprintw(w, 0, 0, "%s", buf);
 
   int width;
   int height;
   getmaxyx(w, height, width);
-  move(rooty + 1, rootx);
-  hline(ACS_HLINE, width - rootx);
+  wmove(w, 1, 0);
+  whline(w, ACS_HLINE, width);
 
-  /*
-   * Print the top pane, with the data specific to the day
-   */
-  strftime(buf, 256, "%Y-%m-%d", selected);
-  cJSON *day_root = find(dates, buf);
-  if (day_root) {
-    cJSON *day_data = find(day_root, "data");
+  int row = store_row(store, selected);
+  if (row >= 0 && store->flags[row] & STORE_PRESENT) {
+    char *day_data = store_data(store, selected);
     if (day_data) {
-      print_multiline(day_data->valuestring, rootx, rooty + 2, width - rootx, height / 2 - rooty - 3);
+      print_multiline(w, day_data, 0, 2, width, height - 3);
     }
   } else {
-    move(rooty + 2, rootx);
-    printw("No entry.");
-  }
-
-  /*
-   * Print the bottom pane, with the recurring tasks
-   */
-  move(height / 2 + 0, rootx);
-  printw("Recurring Weekly");
-  move(height / 2 + 1, rootx);
-  hline(ACS_HLINE, width);
-
-  char *days_short[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-  cJSON *wday_root = find(weekdays, days_short[selected->tm_wday]);
-  if (wday_root) {
-    cJSON *mask = find(day_root, "mask");
-    cJSON *day_data = find(wday_root, "data");
-    if (day_data) {
-      int lines = print_multiline(day_data->valuestring, rootx + 2, height / 2 + 2, width - rootx - 2, 0);
-
-      int val = 0;
-      if (mask && cJSON_IsNumber(mask)) {
-        val = mask->valueint;
-      }
-      for (int i = 1; i < lines + 1; i++) {
-        move(height / 2 + 1 + i, rootx);
-        if (val >> i & 1) {
-          printw("+");
-        } else {
-          printw("o");
-        }
-      }
-    }
+    mvwprintw(w, 2, 0, "No entry.");
   }
 
   /*
    * Print the item counts in the top right corner
    */
-  int green = 0;
-  int yellow = 0;
-  int red = 0;
-  int blue = 0;
-
-  count_status(&green, &yellow, &red, &blue, dates);
+  int green = store->summary.green;
+  int yellow = store->summary.yellow;
+  int red = store->summary.red;
+  int blue = store->summary.blue;
 
   int len = 0;
   if (green) {
@@ -167,148 +136,148 @@ void draw_day_pane(WINDOW *w, int rootx, int rooty, int date_offset, time_t star
   }
   len += 7;
 
-  cJSON *backlog = find(cjson, "backlog");
-  if (backlog) {
-    cJSON *data = find(backlog, "data");
-    if (data) {
-      int j = 0;
-      for (int i = 0; i < strlen(data->valuestring); i++) {
-        if (data->valuestring[i] == '\n') {
-          j++;
-        }
+  int j = store->summary.backlog;
+  if (j) {
+    wmove(w, 0, width - len - 3 - log10(j + 1));
+    wcolor_set(w, 8, NULL);
+    wprintw(w, "(%d)", j);
+    wcolor_set(w, 0, NULL);
+  }
+
+  wattron(w, A_BOLD);
+  wmove(w, 0, width - len);
+  wcolor_set(w, 2, NULL);
+  wprintw(w, "%d", green);
+  wcolor_set(w, 0, NULL);
+  wprintw(w, "/");
+  wcolor_set(w, 3, NULL);
+  wprintw(w, "%d", yellow);
+  wcolor_set(w, 0, NULL);
+  wprintw(w, "/");
+  wcolor_set(w, 4, NULL);
+  wprintw(w, "%d", red);
+  wcolor_set(w, 0, NULL);
+  wprintw(w, "/");
+  wcolor_set(w, 5, NULL);
+  wprintw(w, "%d", blue);
+  wcolor_set(w, 0, NULL);
+  wattroff(w, A_BOLD);
+}
+
+/*
+ * Print the bottom of the right pane, with the recurring tasks
+ */
+void draw_weekly_pane(WINDOW *w, int date_offset, int today, struct store *store, cJSON *weekdays) {
+  int selected = today + date_offset;
+  int width = getmaxx(w);
+
+  mvwprintw(w, 0, 0, "Recurring Weekly");
+  wmove(w, 1, 0);
+  whline(w, ACS_HLINE, width);
+
+  cJSON *wday_root = find(weekdays, days_short[date_weekday(selected)]);
+  if (wday_root) {
+    cJSON *day_data = find(wday_root, "data");
+    if (day_data) {
+      int lines = print_multiline(w, day_data->valuestring, 2, 2, width - 2, 0);
+
+      int row = store_row(store, selected);
+      int val = 0;
+      if (row >= 0 && store->flags[row] & STORE_MASK) {
+        val = store->mask[row];
       }
-      if (j) {
-        move(rooty, width - len - 3 - log10(j + 1));
-        color_set(8, NULL);
-        printw("(%d)", j);
-        color_set(0, NULL);
+      for (int i = 1; i < lines + 1; i++) {
+        mvwprintw(w, 1 + i, 0, val >> i & 1 ? "+" : "o");
       }
     }
   }
-
-  attron(A_BOLD);
-  move(rooty, width - len);
-  color_set(2, NULL);
-  printw("%d", green);
-  color_set(0, NULL);
-  printw("/");
-  color_set(3, NULL);
-  printw("%d", yellow);
-  color_set(0, NULL);
-  printw("/");
-  color_set(4, NULL);
-  printw("%d", red);
-  color_set(0, NULL);
-  printw("/");
-  color_set(5, NULL);
-  printw("%d", blue);
-  color_set(0, NULL);
-  attroff(A_BOLD);
 }
 
 /*
  * Print the left pane
  */
-void draw_cal_pane(WINDOW *w, int rootx, int rooty, int calendar_scroll, int date_offset, char *search_string, int reg_flags, time_t startup_time, cJSON *dates, int calendar_view_mode) {
-
-  regex_t preg;
-  if (regcomp(&preg, search_string, reg_flags) != 0) {
-    exit(EXIT_FAILURE);
-  }
+void draw_cal_pane(WINDOW *w, int calendar_scroll, int date_offset, struct search *search, int today, struct store *store, int calendar_view_mode) {
 
   int width;
   int height;
   getmaxyx(w, height, width);
   height = height + width - width;
+  int rootx = 0;
+  int rooty = 0;
 
-  struct tm *tm = localtime(&startup_time);
-  int current_year = tm->tm_year;
-  int current_mon = tm->tm_mon;
-  int current_mday = tm->tm_mday;
+  int current_year, current_mon, current_mday;
+  civil_from_days(today, &current_year, &current_mon, &current_mday);
 
-  time_t initial_time = startup_time - (calendar_scroll * 7) * ONEDAY;
+  int initial_day = today - calendar_scroll * 7;
 
-  clear();
-  move(rooty, rootx + 4);
-  printw("Su Mo Tu We Th Fr Sa");
-  move(rooty + 1, rootx + 4);
-  hline(ACS_HLINE, 21);
+  mvwprintw(w, rooty, rootx + 4, "Su Mo Tu We Th Fr Sa");
+  wmove(w, rooty + 1, rootx + 4);
+  whline(w, ACS_HLINE, 21);
 
-  move(rooty + 1, rootx);
-  printw("'%d", tm->tm_year - 100);
-  int off = tm->tm_wday;
+  mvwprintw(w, rooty + 1, rootx, "'%d", current_year - 2000);
+  int off = date_weekday(today);
 
-  for (int i = -tm->tm_wday;; i++) {
-    time_t t = initial_time + i * ONEDAY;
-    struct tm *tm = localtime(&t);
+  for (int i = -off;; i++) {
+    int day = initial_day + i;
+    int year, mon, mday;
+    civil_from_days(day, &year, &mon, &mday);
 
     int line = rooty + 2 + (i + off) / 7;
-    move(line, rootx + ((i + off) % 7) * 3 + 4);
-    if (line > height - 2) {
+    wmove(w, line, rootx + ((i + off) % 7) * 3 + 4);
+    if (line > height - 1) {
       break;
     }
 
-    char buf[256];
-    sprintf(buf, "%d-%2.2d-%2.2d", 1900 + tm->tm_year, tm->tm_mon + 1,
-            tm->tm_mday);
-    cJSON *root = find(dates, buf);
+    int row = store_row(store, day);
     int num_tasks = 0;
-    if (root) {
-      attron(A_BOLD);
-      cJSON *day_data = find(root, "data");
-      if (day_data) {
-        if (has_incomplete_tasks(day_data->valuestring) &&
-            current_mday + current_mon * 100 + current_year * 10000 >
-                tm->tm_mday + tm->tm_mon * 100 + tm->tm_year * 10000) {
-          color_set(7, NULL);
-        }
-        for (int i = 0; i < strlen(day_data->valuestring); i++) {
-          if (day_data->valuestring[i] == '\n') {
-            num_tasks++;
-          }
+    if (row >= 0 && store->flags[row] & STORE_PRESENT) {
+      wattron(w, A_BOLD);
+      if (store->flags[row] & (STORE_DATA | STORE_ENCODED)) {
+        if (store->flags[row] & STORE_INCOMPLETE && day < today) {
+          wcolor_set(w, 7, NULL);
         }
-        if (has_important_tasks(day_data->valuestring)) {
-          color_set(7, NULL);
+        num_tasks = store->lines[row];
+        if (store->flags[row] & STORE_IMPORTANT) {
+          wcolor_set(w, 7, NULL);
         }
       }
     }
 
-    if (strlen(search_string) > 0 && root) {
-      cJSON *day_data = find(root, "data");
+    if (row >= 0 && search->compiled) {
+      char *day_data = store_data(store, day);
       if (day_data) {
-        if (regexec(&preg, day_data->valuestring, 0, NULL, 0) == 0) {
-          attroff(A_BOLD);
-          color_set(6, NULL);
+        if (search_match(search, day, day_data)) {
+          wattroff(w, A_BOLD);
+          wcolor_set(w, 6, NULL);
         }
       }
     }
 
     if (i == date_offset + calendar_scroll * 7) {
-      attron(A_REVERSE);
+      wattron(w, A_REVERSE);
     }
 
     if (calendar_view_mode == 0) {
-      printw("%d", tm->tm_mday);
+      wprintw(w, "%d", mday);
     } else if (calendar_view_mode == 1) {
       if (num_tasks != 0) {
-        printw("%d", num_tasks);
+        wprintw(w, "%d", num_tasks);
       }
     } else {
-      printw("%d", tm->tm_mon + 1);
+      wprintw(w, "%d", mon);
     }
-    color_set(0, NULL);
-    attroff(A_BOLD);
-    attroff(A_REVERSE);
+    wcolor_set(w, 0, NULL);
+    wattroff(w, A_BOLD);
+    wattroff(w, A_REVERSE);
 
-    if (tm->tm_mday == 1) {
-      move(line, rootx);
-      printw("%s", months_short[tm->tm_mon]);
+    if (mday == 1) {
+      mvwprintw(w, line, rootx, "%s", months_short[mon - 1]);
     }
   }
 
-  move(rooty, rootx + 25);
-  vline(ACS_VLINE, height - 1);
-  mvaddch(rooty + 1, rootx + 25, ACS_RTEE);
+  wmove(w, rooty, rootx + 25);
+  wvline(w, ACS_VLINE, height);
+  mvwaddch(w, rooty + 1, rootx + 25, ACS_RTEE);
 }
 
 void draw_help() {
@@ -330,23 +299,187 @@ void draw_help() {
               "| e                | Cycles views in the calendar pane.                |\n"
               "| /                | Search for a string in day data using regex.      |\n"
               "| \\                | Same as '/', but is case insensitive.             |\n"
+              "| ], [             | Jump to the next or previous day that matches.    |\n"
+              "| T                | Show or hide the timings overlay.                 |\n"
               "| Cursor keys      | Scroll the calendar.                              |\n"
               "\n"
               "Press any key to continue...\n";
 
-  print_multiline(str, 0, 0, 80, 0);
+  print_multiline(stdscr, str, 0, 0, 80, 0);
 }
 
 void draw_statusline(WINDOW *w, char *status_line) {
-  int width;
-  int height;
-  getmaxyx(w, height, width);
+  int width = getmaxx(w);
 
   status_line[200] = 0;
-  move(height - 1, 0);
-  printw(status_line);
+  mvwprintw(w, 0, 0, "%s", status_line);
+  mvwprintw(w, 0, width - 19, "Type '?' for help.");
+}
+
+/*
+ * A table of how long each phase has taken, inside a box
+ */
+void draw_stats(WINDOW *w, struct stats *stats) {
+  box(w, 0, 0);
+  mvwprintw(w, 0, 2, " Timings ");
+  mvwprintw(w, 1, 2, "%-8s %7s %9s %9s %9s", "phase", "count", "p50", "p99", "max");
+  int line = 2;
+  for (int i = 0; i < STAT_COUNT && line < getmaxy(w) - 1; i++) {
+    struct histogram *histogram = &stats->histograms[i];
+    if (!histogram->count) {
+      continue;
+    }
+    char p50[16];
+    char p99[16];
+    char max[16];
+    stats_format(stats_percentile(histogram, 0.5), p50);
+    stats_format(stats_percentile(histogram, 0.99), p99);
+    stats_format(histogram->max, max);
+    mvwprintw(w, line++, 2, "%-8s %7lu %9s %9s %9s", stats_name(i), histogram->count, p50, p99, max);
+  }
+}
+
+/*
+ * The regions of the screen, as bits of 'valid'
+ */
+#define REGION_CALENDAR 1
+#define REGION_DAY 2
+#define REGION_WEEKLY 4
+#define REGION_STATUS 8
+
+/*
+ * Create the windows, or create them again if the terminal changed size.
+ * The calendar takes the left 27 columns and the day and its recurring tasks
+ * share the rest, above the status line.
+ */
+void screen_layout(struct screen *screen) {
+  int lines;
+  int columns;
+  getmaxyx(stdscr, lines, columns);
+  if (screen->calendar && lines == screen->lines && columns == screen->columns) {
+    return;
+  }
+
+  screen_free(screen);
+  /*
+   * stdscr stays empty, but getch() paints it over the panes whenever it was
+   * touched, as it is at startup and by a resize
+   */
+  wnoutrefresh(stdscr);
+  screen->lines = lines;
+  screen->columns = columns;
+  screen->calendar = newwin(lines - 1, 27, 0, 0);
+  screen->day = newwin(lines / 2, columns - 27, 0, 27);
+  screen->weekly = newwin(lines - 1 - lines / 2, columns - 27, lines / 2, 27);
+  screen->status = newwin(1, columns, lines - 1, 0);
+  screen_invalidate(screen);
+}
+
+/*
+ * Draw every region again on the next frame, and have ncurses repaint the
+ * whole terminal, for when something else has written to it
+ */
+void screen_invalidate(struct screen *screen) {
+  screen->valid = 0;
+  if (screen->calendar) {
+    clearok(curscr, TRUE);
+  }
+}
 
-  move(height - 1, width - 19);
-  printw("Type '?' for help.");
+/*
+ * Draw the regions whose inputs changed since they were last drawn. The
+ * caller sends the result to the terminal with doupdate().
+ */
+void screen_draw(struct screen *screen, struct view *view, struct search *search, char *status_line, struct store *store, cJSON *weekdays) {
+  if (!screen->calendar) {
+    return;
+  }
 
+  struct view *drawn = &screen->drawn;
+  int selected = view->today + view->date_offset;
+  int row = store_row(store, selected);
+  int mask = row >= 0 && store->flags[row] & STORE_MASK ? store->mask[row] : 0;
+  int weekday = date_weekday(selected);
+
+  int same_data = screen->valid && view->generation == drawn->generation;
+  int same_search = search->serial == screen->search;
+
+  if (!(screen->valid & REGION_CALENDAR) || !same_data || !same_search ||
+      view->calendar_scroll != drawn->calendar_scroll || view->date_offset != drawn->date_offset ||
+      view->today != drawn->today || view->calendar_view_mode != drawn->calendar_view_mode ||
+      view->modified != drawn->modified) {
+    werase(screen->calendar);
+    draw_cal_pane(screen->calendar, view->calendar_scroll, view->date_offset, search, view->today, store,
+                  view->calendar_view_mode);
+    if (view->modified) {
+      mvwprintw(screen->calendar, 0, 0, "(*)");
+    }
+    wnoutrefresh(screen->calendar);
+  }
+
+  if (!(screen->valid & REGION_DAY) || !same_data || selected != drawn->today + drawn->date_offset) {
+    werase(screen->day);
+    draw_day_pane(screen->day, view->date_offset, view->today, store);
+    wnoutrefresh(screen->day);
+  }
+
+  if (!(screen->valid & REGION_WEEKLY) || !same_data || weekday != screen->weekday || mask != screen->mask) {
+    werase(screen->weekly);
+    draw_weekly_pane(screen->weekly, view->date_offset, view->today, store, weekdays);
+    wnoutrefresh(screen->weekly);
+  }
+
+  if (!(screen->valid & REGION_STATUS) || strcmp(status_line, screen->status_line) != 0) {
+    werase(screen->status);
+    draw_statusline(screen->status, status_line);
+    wnoutrefresh(screen->status);
+  }
+
+  screen->drawn = *view;
+  screen->search = search->serial;
+  screen->weekday = weekday;
+  screen->mask = mask;
+  strcpy(screen->status_line, status_line);
+  screen->valid = REGION_CALENDAR | REGION_DAY | REGION_WEEKLY | REGION_STATUS;
+}
+
+/*
+ * Draw the timings over the bottom right corner of the screen. They change
+ * every frame, so they are always drawn, after the panes beneath them.
+ */
+void screen_stats(struct screen *screen, struct stats *stats) {
+  int height = STAT_COUNT + 3;
+  int width = 50;
+  if (!screen->calendar || screen->lines - 1 < height || screen->columns - 27 < width) {
+    return;
+  }
+  if (!screen->stats) {
+    screen->stats = newwin(height, width, screen->lines - 1 - height, screen->columns - width);
+  }
+  werase(screen->stats);
+  draw_stats(screen->stats, stats);
+  wnoutrefresh(screen->stats);
+}
+
+/*
+ * Show a prompt in place of the status line until the next frame
+ */
+void screen_prompt(struct screen *screen, char symbol, char *text) {
+  if (!screen->status) {
+    return;
+  }
+  werase(screen->status);
+  mvwprintw(screen->status, 0, 0, "%c%s", symbol, text);
+  wnoutrefresh(screen->status);
+  screen->valid &= ~REGION_STATUS;
+}
+
+void screen_free(struct screen *screen) {
+  WINDOW **windows[] = {&screen->calendar, &screen->day, &screen->weekly, &screen->status, &screen->stats};
+  for (int i = 0; i < 5; i++) {
+    if (*windows[i]) {
+      delwin(*windows[i]);
+      *windows[i] = NULL;
+    }
+  }
 }
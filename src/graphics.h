@@ -1,10 +1,57 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
-int print_multiline(char *str, int rootx, int rooty, int width, int height);
-void draw_cal_pane(WINDOW *w, int rootx, int rooty, int calendar_scroll, int date_offset, char *search_string, int reg_flags, time_t startup_time, cJSON *dates, int calendar_view_mode);
-void draw_day_pane(WINDOW *w, int rootx, int rooty, int date_offset, time_t startup_time, cJSON *dates, cJSON *weekdays, cJSON *cjson);
+struct search;
+struct stats;
+struct store;
+
+/*
+ * What the main loop shows. A region of the screen is only drawn again when
+ * the parts of this it depends on have changed since it was last drawn.
+ */
+struct view {
+  int calendar_scroll;
+  int date_offset;
+  int today;
+  int calendar_view_mode;
+  int modified;
+  unsigned long generation;
+};
+
+/*
+ * The screen is split into windows that keep their contents between frames,
+ * along with what each of them was last drawn from. Redrawn windows are only
+ * copied out with wnoutrefresh(), so doupdate() sends just the cells that
+ * differ from what the terminal already shows.
+ */
+struct screen {
+  WINDOW *calendar;
+  WINDOW *day;
+  WINDOW *weekly;
+  WINDOW *status;
+  WINDOW *stats;
+  int lines;
+  int columns;
+  int valid;
+  struct view drawn;
+  unsigned long search;
+  int weekday;
+  int mask;
+  char status_line[256];
+};
+
+int print_multiline(WINDOW *w, char *str, int rootx, int rooty, int width, int height);
+void draw_cal_pane(WINDOW *w, int calendar_scroll, int date_offset, struct search *search, int today, struct store *store, int calendar_view_mode);
+void draw_day_pane(WINDOW *w, int date_offset, int today, struct store *store);
+void draw_weekly_pane(WINDOW *w, int date_offset, int today, struct store *store, cJSON *weekdays);
 void draw_help();
 void draw_statusline(WINDOW *w, char *status_line);
+void draw_stats(WINDOW *w, struct stats *stats);
+void screen_layout(struct screen *screen);
+void screen_invalidate(struct screen *screen);
+void screen_draw(struct screen *screen, struct view *view, struct search *search, char *status_line, struct store *store, cJSON *weekdays);
+void screen_stats(struct screen *screen, struct stats *stats);
+void screen_prompt(struct screen *screen, char symbol, char *text);
+void screen_free(struct screen *screen);
 
 #endif
@@ -0,0 +1,227 @@
+#include <cjson/cJSON.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grep.h"
+#include "json.h"
+#include "store.h"
+
+static int max_threads;
+
+/*
+ * A copy of the texts to be searched, taken on the calling thread so that the
+ * workers never touch the store, whose arena moves whenever a day is decoded
+ * or changed. Texts that are still escaped in the source file are copied as
+ * they are and decoded by the worker that tests them.
+ */
+struct corpus {
+  int count;
+  size_t *offset;
+  int *length;
+  unsigned char *escaped;
+  char *text;
+};
+
+/*
+ * The state shared by the workers of one search. Chunk 'i' is the entries
+ * from 'bounds[i]' up to 'bounds[i + 1]'. Each worker claims the next chunk
+ * until none are left, and only writes the bytes of 'matched' for the entries
+ * in its chunks.
+ */
+struct job {
+  struct corpus *corpus;
+  const char *pattern;
+  int flags;
+  int literal;
+  int chunks;
+  int *bounds;
+  int next;
+  unsigned char *matched;
+};
+
+static void *allocate(size_t size) {
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/*
+ * Set the most threads a search uses, or one per processor if 'threads' is 0
+ */
+void grep_threads(int threads) { max_threads = threads; }
+
+static int thread_count(size_t bytes) {
+  long threads = max_threads;
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  long useful = bytes / GREP_CHUNK + 1;
+  if (threads > useful) {
+    threads = useful;
+  }
+  if (threads > GREP_MAX_THREADS) {
+    threads = GREP_MAX_THREADS;
+  }
+  return threads < 1 ? 1 : threads;
+}
+
+/*
+ * Copy the texts of 'days' out of the store. Days without a text are left
+ * empty, which no search matches.
+ */
+static void corpus_take(struct corpus *corpus, struct store *store, const int *days, int count) {
+  corpus->count = count;
+  corpus->offset = allocate(count * sizeof(size_t));
+  corpus->length = allocate(count * sizeof(int));
+  corpus->escaped = allocate(count);
+
+  size_t size = 0;
+  for (int i = 0; i < count; i++) {
+    int row = store_row(store, days[i]);
+    int flags = row < 0 ? 0 : store->flags[row];
+    corpus->escaped[i] = (flags & STORE_ENCODED) != 0;
+    corpus->length[i] = flags & STORE_ENCODED ? store->raw_length[row] : flags & STORE_DATA ? store->length[row] : 0;
+    corpus->offset[i] = size;
+    size += corpus->length[i] + 1;
+  }
+
+  corpus->text = allocate(size);
+  for (int i = 0; i < count; i++) {
+    char *text = corpus->text + corpus->offset[i];
+    if (corpus->length[i]) {
+      int row = store_row(store, days[i]);
+      if (corpus->escaped[i]) {
+        memcpy(text, store->source + store->raw[row], corpus->length[i]);
+      } else {
+        memcpy(text, store->arena + store->offset[row], corpus->length[i]);
+      }
+    }
+    text[corpus->length[i]] = 0;
+  }
+}
+
+static void corpus_free(struct corpus *corpus) {
+  free(corpus->offset);
+  free(corpus->length);
+  free(corpus->escaped);
+  free(corpus->text);
+}
+
+/*
+ * Test chunks of the corpus until there are none left. Every worker compiles
+ * its own copy of the pattern, as regexec() locks a compiled pattern while it
+ * runs and would otherwise let only one thread match at a time.
+ */
+static void *work(void *arg) {
+  struct job *job = arg;
+  struct corpus *corpus = job->corpus;
+
+  regex_t preg;
+  if (!job->literal && regcomp(&preg, job->pattern, job->flags) != 0) {
+    return NULL;
+  }
+
+  char *decoded = NULL;
+  size_t capacity = 0;
+  int chunk;
+  while ((chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->chunks) {
+    for (int i = job->bounds[chunk]; i < job->bounds[chunk + 1]; i++) {
+      if (!corpus->length[i]) {
+        continue;
+      }
+
+      char *text = corpus->text + corpus->offset[i];
+      if (corpus->escaped[i]) {
+        if (capacity < (size_t)corpus->length[i] + 1) {
+          capacity = corpus->length[i] + 1;
+          free(decoded);
+          decoded = allocate(capacity);
+        }
+        json_decode_string(text, corpus->length[i], decoded);
+        text = decoded;
+      }
+
+      if (job->literal) {
+        job->matched[i] = strstr(text, job->pattern) != NULL;
+      } else {
+        job->matched[i] = regexec(&preg, text, 0, NULL, 0) == 0;
+      }
+    }
+  }
+
+  free(decoded);
+  if (!job->literal) {
+    regfree(&preg);
+  }
+  return NULL;
+}
+
+/*
+ * Find the days among 'days', which must be in ascending order, whose text
+ * matches a basic regular expression compiled with 'flags'. The texts are
+ * copied and split into chunks that a thread per processor tests in parallel,
+ * the calling thread being one of them, and a pattern of plain characters is
+ * looked for with strstr() instead of a regex. Returns the number of matches,
+ * with the days in ascending order in '*matches' to be freed by the caller,
+ * or -1 if the pattern does not compile.
+ */
+int grep_days(struct store *store, const int *days, int count, const char *pattern, int flags, int **matches) {
+  *matches = NULL;
+  regex_t preg;
+  if (!pattern[0] || regcomp(&preg, pattern, flags) != 0) {
+    return -1;
+  }
+  regfree(&preg);
+
+  struct corpus corpus;
+  corpus_take(&corpus, store, days, count);
+
+  struct job job = {&corpus, pattern, flags, 0, 0, NULL, 0, NULL};
+  job.literal = !(flags & REG_ICASE) && strpbrk(pattern, ".[]*^$\\") == NULL;
+  job.matched = calloc(count ? count : 1, 1);
+  job.bounds = allocate((count + 1) * sizeof(int));
+  if (!job.matched) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t bytes = 0;
+  job.bounds[0] = 0;
+  for (int i = 0; i < count; i++) {
+    bytes += corpus.length[i];
+    if (bytes >= GREP_CHUNK * (size_t)(job.chunks + 1) || i == count - 1) {
+      job.bounds[++job.chunks] = i + 1;
+    }
+  }
+
+  int threads = thread_count(bytes);
+  pthread_t workers[GREP_MAX_THREADS];
+  int started = 0;
+  while (started < threads - 1 && pthread_create(&workers[started], NULL, work, &job) == 0) {
+    started++;
+  }
+  work(&job);
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  int found = 0;
+  *matches = allocate(count * sizeof(int));
+  for (int i = 0; i < count; i++) {
+    if (job.matched[i]) {
+      (*matches)[found++] = days[i];
+    }
+  }
+
+  free(job.matched);
+  free(job.bounds);
+  corpus_free(&corpus);
+  return found;
+}
@@ -0,0 +1,15 @@
+#ifndef GREP_H
+#define GREP_H
+
+struct store;
+
+/*
+ * Texts are handed to the workers in chunks of about this many bytes
+ */
+#define GREP_CHUNK (64 * 1024)
+#define GREP_MAX_THREADS 64
+
+void grep_threads(int threads);
+int grep_days(struct store *store, const int *days, int count, const char *pattern, int flags, int **matches);
+
+#endif
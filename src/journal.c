@@ -0,0 +1,348 @@
+#include <cjson/cJSON.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "date.h"
+#include "journal.h"
+#include "store.h"
+#include "util.h"
+
+/*
+ * The CRC-32 of the contents of the file at 'path'. Returns 0 on success.
+ */
+static int file_crc(char *path, uLong *crc) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return -1;
+  }
+  unsigned char buffer[1 << 16];
+  size_t n;
+  *crc = crc32(0, Z_NULL, 0);
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    *crc = crc32(*crc, buffer, n);
+  }
+  int failed = ferror(f);
+  fclose(f);
+  return failed ? -1 : 0;
+}
+
+/*
+ * The first record of a journal identifies the version of the calendar file
+ * it was written against. The size and time tell cheaply that the file is
+ * unchanged, and the CRC of its contents that a file that was touched or
+ * copied is still the same.
+ */
+static cJSON *base_record(char *calendar) {
+  struct stat st;
+  uLong crc;
+  if (stat(calendar, &st) != 0 || file_crc(calendar, &crc) != 0) {
+    return NULL;
+  }
+
+  cJSON *record = cJSON_CreateObject();
+  cJSON_AddStringToObject(record, "op", "base");
+  cJSON_AddNumberToObject(record, "size", st.st_size);
+  cJSON_AddNumberToObject(record, "mtime", st.st_mtim.tv_sec);
+  cJSON_AddNumberToObject(record, "mtime_nsec", st.st_mtim.tv_nsec);
+  cJSON_AddNumberToObject(record, "crc", crc);
+  return record;
+}
+
+static int same_number(cJSON *a, cJSON *b, char *key) {
+  cJSON *x = find(a, key);
+  cJSON *y = find(b, key);
+  return x && y && cJSON_IsNumber(x) && cJSON_IsNumber(y) && x->valuedouble == y->valuedouble;
+}
+
+static char *string_field(cJSON *record, char *key) {
+  cJSON *node = find(record, key);
+  return node && cJSON_IsString(node) ? node->valuestring : NULL;
+}
+
+/*
+ * Apply one record to the tree and the store
+ */
+static void apply(cJSON *record, cJSON *root, struct store *store) {
+  char *op = string_field(record, "op");
+  char *tag = string_field(record, "tag");
+  char *data = string_field(record, "data");
+  cJSON *mask = find(record, "mask");
+  int day;
+
+  if (!op) {
+    return;
+  }
+
+  if (strcmp(op, "put") == 0 && tag && date_parse(tag, &day)) {
+    if (data) {
+      store_set_data(store, day, data);
+    }
+    if (mask && cJSON_IsNumber(mask)) {
+      store_set_mask(store, day, mask->valueint);
+    }
+  } else if (strcmp(op, "mask") == 0 && tag && date_parse(tag, &day)) {
+    if (mask && cJSON_IsNumber(mask)) {
+      store_set_mask(store, day, mask->valueint);
+    }
+  } else if (strcmp(op, "delete") == 0 && tag && date_parse(tag, &day)) {
+    store_remove(store, day);
+  } else if (strcmp(op, "weekday") == 0 && tag && data) {
+    set_data(find(root, "weekdays"), tag, data);
+  } else if (strcmp(op, "backlog") == 0 && data) {
+    set_data(root, "backlog", data);
+  }
+}
+
+static int write_record(FILE *f, cJSON *record) {
+  char *str = cJSON_PrintUnformatted(record);
+  int failed = !str || fprintf(f, "%s\n", str) < 0;
+  free(str);
+  return failed;
+}
+
+/*
+ * Move a file that is not a journal out of the way, under a name that is not
+ * taken yet, so that nothing moved aside before is lost
+ */
+static void move_aside(char *path) {
+  char stale[PATH_MAX + 32];
+  for (int i = 0; i < 1000; i++) {
+    if (i) {
+      snprintf(stale, sizeof(stale), "%s.stale.%d", path, i);
+    } else {
+      snprintf(stale, sizeof(stale), "%s.stale", path);
+    }
+    if (link(path, stale) == 0) {
+      unlink(path);
+      return;
+    }
+    if (errno != EEXIST) {
+      if (access(stale, F_OK) != 0) {
+        rename(path, stale);
+      }
+      return;
+    }
+  }
+}
+
+/*
+ * Write the records between 'from' and 'to' in the journal again behind a
+ * base record for the calendar file as it is now
+ */
+static int rebase(struct journal *journal, char *calendar, long from, long to) {
+  char temp[PATH_MAX + 8];
+  snprintf(temp, sizeof(temp), "%s.tmp", journal->path);
+  FILE *in = fopen(journal->path, "rb");
+  FILE *out = fopen(temp, "wb");
+  cJSON *base = base_record(calendar);
+  int failed = !in || !out || !base || write_record(out, base) || fseek(in, from, SEEK_SET) != 0;
+
+  char buffer[1 << 16];
+  for (long left = to - from; left > 0 && !failed;) {
+    size_t n = fread(buffer, 1, left < (long)sizeof(buffer) ? (size_t)left : sizeof(buffer), in);
+    failed |= n == 0 || fwrite(buffer, 1, n, out) != n;
+    left -= n;
+  }
+
+  cJSON_Delete(base);
+  if (in) {
+    fclose(in);
+  }
+  if (out) {
+    failed |= fflush(out) != 0 || fsync(fileno(out)) != 0;
+    failed |= fclose(out) != 0;
+  }
+  if (failed || rename(temp, journal->path) != 0) {
+    unlink(temp);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Apply the journal that belongs to 'calendar', if there is one. The changes
+ * are written into the store, which is then marked as saved. A record torn by
+ * a crash can only be the last one, so it is cut off.
+ *
+ * If the calendar file was touched, copied or changed since the journal was
+ * started, the journal is written again against the file as it is now. A
+ * changed file has the journaled days applied over it, as the open calendar's
+ * own changes win in a merge, and '*changed' is set. Returns the number of
+ * records applied, or -1 if the file is not a journal, in which case it is
+ * moved aside.
+ */
+int journal_replay(struct journal *journal, char *calendar, cJSON *root, struct store *store, int *changed) {
+  snprintf(journal->path, PATH_MAX, "%s.journal", calendar);
+  journal->size = 0;
+  *changed = 0;
+
+  FILE *f = fopen(journal->path, "rb");
+  if (!f) {
+    return 0;
+  }
+
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t len;
+  long good = 0;
+  long body = 0;
+  int moved = 0;
+  int count = 0;
+
+  while ((len = getline(&line, &capacity, f)) > 0) {
+    if (line[len - 1] != '\n') {
+      break;
+    }
+    cJSON *record = cJSON_Parse(line);
+    if (!record) {
+      break;
+    }
+
+    if (good == 0) {
+      char *op = string_field(record, "op");
+      if (!op || strcmp(op, "base") != 0) {
+        cJSON_Delete(record);
+        free(line);
+        fclose(f);
+        move_aside(journal->path);
+        return -1;
+      }
+
+      cJSON *base = base_record(calendar);
+      moved = !base || !same_number(record, base, "size") || !same_number(record, base, "mtime") ||
+              !same_number(record, base, "mtime_nsec");
+      *changed = moved && !(base && same_number(record, base, "crc"));
+      cJSON_Delete(base);
+      body = len;
+    } else {
+      apply(record, root, store);
+      count++;
+    }
+
+    cJSON_Delete(record);
+    good += len;
+  }
+
+  free(line);
+  fclose(f);
+
+  if (count == 0) {
+    unlink(journal->path);
+    *changed = 0;
+    return 0;
+  }
+  if (moved && rebase(journal, calendar, body, good) == 0) {
+    struct stat st;
+    good = stat(journal->path, &st) == 0 ? st.st_size : good;
+  } else {
+    truncate(journal->path, good);
+  }
+  journal->size = good;
+
+  store_saved(store);
+  return count;
+}
+
+/*
+ * Create a record for a change to a weekday ("weekday") or to the backlog
+ * ("backlog"), to be passed to 'journal_append'
+ */
+cJSON *journal_text(char *op, char *tag, char *data) {
+  cJSON *record = cJSON_CreateObject();
+  cJSON_AddStringToObject(record, "op", op);
+  if (tag) {
+    cJSON_AddStringToObject(record, "tag", tag);
+  }
+  cJSON_AddStringToObject(record, "data", data);
+  return record;
+}
+
+/*
+ * The record for a dirty row. A row whose text is unchanged only needs its
+ * mask.
+ */
+static cJSON *day_record(struct store *store, int row) {
+  char tag[DATE_LEN];
+  date_format(store->base + row, tag);
+
+  cJSON *record = cJSON_CreateObject();
+  unsigned short flags = store->flags[row];
+  if (!(flags & STORE_PRESENT)) {
+    cJSON_AddStringToObject(record, "op", "delete");
+    cJSON_AddStringToObject(record, "tag", tag);
+    return record;
+  }
+
+  cJSON_AddStringToObject(record, "op", flags & STORE_DATA_DIRTY ? "put" : "mask");
+  cJSON_AddStringToObject(record, "tag", tag);
+  if (flags & STORE_DATA_DIRTY && flags & STORE_DATA) {
+    cJSON_AddStringToObject(record, "data", store->arena + store->offset[row]);
+  }
+  if (flags & STORE_MASK) {
+    cJSON_AddNumberToObject(record, "mask", store->mask[row]);
+  }
+  return record;
+}
+
+/*
+ * Append the dirty rows of the store, followed by 'records', and sync the
+ * journal to disk. The store is left dirty so that the caller can mark it as
+ * saved afterwards. Returns 0 on success.
+ */
+int journal_append(struct journal *journal, char *calendar, struct store *store, cJSON *records) {
+  snprintf(journal->path, PATH_MAX, "%s.journal", calendar);
+
+  FILE *f = fopen(journal->path, "ab");
+  if (!f) {
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long start = ftell(f);
+
+  int failed = 0;
+  if (start == 0) {
+    cJSON *base = base_record(calendar);
+    failed |= !base || write_record(f, base);
+    cJSON_Delete(base);
+  }
+
+  for (int i = 0; i < store->rows && !failed; i++) {
+    if (store->flags[i] & STORE_DIRTY) {
+      cJSON *record = day_record(store, i);
+      failed |= write_record(f, record);
+      cJSON_Delete(record);
+    }
+  }
+
+  for (cJSON *record = records ? records->child : NULL; record && !failed; record = record->next) {
+    failed |= write_record(f, record);
+  }
+
+  failed |= fflush(f) != 0 || fsync(fileno(f)) != 0;
+  failed |= fclose(f) != 0;
+
+  if (failed) {
+    truncate(journal->path, start);
+    return -1;
+  }
+
+  struct stat st;
+  journal->size = stat(journal->path, &st) == 0 ? st.st_size : start;
+  return 0;
+}
+
+/*
+ * Forget the journal once its changes are part of the calendar file
+ */
+void journal_reset(struct journal *journal) {
+  if (journal->path[0]) {
+    unlink(journal->path);
+  }
+  journal->size = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/*
+ * Saves that would otherwise rewrite the whole calendar are appended to this
+ * file instead, one JSON record per line, until it grows past JOURNAL_LIMIT
+ * and is folded back into the calendar file
+ */
+#define JOURNAL_LIMIT (1 << 20)
+
+struct store;
+
+struct journal {
+  char path[PATH_MAX];
+  long size;
+};
+
+int journal_replay(struct journal *journal, char *calendar, cJSON *root, struct store *store, int *changed);
+cJSON *journal_text(char *op, char *tag, char *data);
+int journal_append(struct journal *journal, char *calendar, struct store *store, cJSON *records);
+void journal_reset(struct journal *journal);
+
+#endif
@@ -0,0 +1,270 @@
+#include <cjson/cJSON.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+/*
+ * Write a string as a quoted JSON string, escaped the same way cJSON does
+ */
+void json_write_string(FILE *f, char *str) {
+  putc('"', f);
+  for (unsigned char *p = (unsigned char *)str; *p; p++) {
+    switch (*p) {
+    case '"':
+      fputs("\\\"", f);
+      break;
+    case '\\':
+      fputs("\\\\", f);
+      break;
+    case '\b':
+      fputs("\\b", f);
+      break;
+    case '\f':
+      fputs("\\f", f);
+      break;
+    case '\n':
+      fputs("\\n", f);
+      break;
+    case '\r':
+      fputs("\\r", f);
+      break;
+    case '\t':
+      fputs("\\t", f);
+      break;
+    default:
+      if (*p < 32) {
+        fprintf(f, "\\u%04x", *p);
+      } else {
+        putc(*p, f);
+      }
+    }
+  }
+  putc('"', f);
+}
+
+/*
+ * Write a number using the shortest of cJSON's formats that round-trips
+ */
+static void write_number(FILE *f, cJSON *node) {
+  double d = node->valuedouble;
+  if (isnan(d) || isinf(d)) {
+    fputs("null", f);
+  } else if (d == (double)node->valueint) {
+    fprintf(f, "%d", node->valueint);
+  } else {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%1.15g", d);
+    if (strtod(buf, NULL) != d) {
+      snprintf(buf, sizeof(buf), "%1.17g", d);
+    }
+    fputs(buf, f);
+  }
+}
+
+void json_indent(FILE *f, int depth) {
+  for (int i = 0; i < depth; i++) {
+    putc('\t', f);
+  }
+}
+
+/*
+ * Stream a cJSON tree to a file in the same layout as cJSON_Print, without
+ * building the whole document in memory first
+ */
+void json_write(FILE *f, cJSON *node, int depth) {
+  switch (node->type & 0xFF) {
+  case cJSON_False:
+    fputs("false", f);
+    break;
+  case cJSON_True:
+    fputs("true", f);
+    break;
+  case cJSON_NULL:
+    fputs("null", f);
+    break;
+  case cJSON_Number:
+    write_number(f, node);
+    break;
+  case cJSON_Raw:
+    fputs(node->valuestring ? node->valuestring : "", f);
+    break;
+  case cJSON_String:
+    json_write_string(f, node->valuestring ? node->valuestring : "");
+    break;
+  case cJSON_Array:
+    putc('[', f);
+    for (cJSON *child = node->child; child; child = child->next) {
+      json_write(f, child, depth + 1);
+      if (child->next) {
+        fputs(", ", f);
+      }
+    }
+    putc(']', f);
+    break;
+  case cJSON_Object:
+    fputs("{\n", f);
+    for (cJSON *child = node->child; child; child = child->next) {
+      json_indent(f, depth + 1);
+      json_write_string(f, child->string);
+      fputs(":\t", f);
+      json_write(f, child, depth + 1);
+      if (child->next) {
+        putc(',', f);
+      }
+      putc('\n', f);
+    }
+    json_indent(f, depth);
+    putc('}', f);
+    break;
+  }
+}
+
+const char *json_skip_space(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+/*
+ * Skip the string starting at the quote at 'p' without decoding it. Returns
+ * the position after the closing quote, or NULL if there is none.
+ */
+const char *json_skip_string(const char *p, const char *end) {
+  const char *start = p + 1;
+  for (p = start; p < end; p++) {
+    p = memchr(p, '"', end - p);
+    if (!p) {
+      return NULL;
+    }
+
+    const char *q = p;
+    while (q > start && q[-1] == '\\') {
+      q--;
+    }
+    if ((p - q) % 2 == 0) {
+      return p + 1;
+    }
+  }
+  return NULL;
+}
+
+static int hex(const char *p) {
+  int value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (digit < 0) {
+      return -1;
+    }
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+/*
+ * Decode the 'length' bytes between the quotes of a string into 'out', which
+ * must hold 'length' + 1 bytes, as no escape is shorter than what it stands
+ * for. Unlike cJSON this keeps no global state, so it can run on any thread.
+ * An invalid escape is copied as it is. Returns the decoded length.
+ */
+size_t json_decode_string(const char *p, size_t length, char *out) {
+  const char *end = p + length;
+  char *o = out;
+  while (p < end) {
+    const char *escape = memchr(p, '\\', end - p);
+    size_t plain = (escape ? escape : end) - p;
+    memcpy(o, p, plain);
+    o += plain;
+    p += plain;
+    if (p + 1 >= end) {
+      break;
+    }
+
+    char c = p[1];
+    const char *simple = strchr("\"\\/bfnrt", c);
+    if (c && simple) {
+      *o++ = "\"\\/\b\f\n\r\t"[simple - "\"\\/bfnrt"];
+      p += 2;
+      continue;
+    }
+
+    int code = c == 'u' && end - p >= 6 ? hex(p + 2) : -1;
+    if (code < 0) {
+      *o++ = *p++;
+      continue;
+    }
+    p += 6;
+    if (code >= 0xd800 && code < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+      int low = hex(p + 2);
+      if (low >= 0xdc00 && low < 0xe000) {
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        p += 6;
+      }
+    }
+
+    if (code < 0x80) {
+      *o++ = code;
+    } else if (code < 0x800) {
+      *o++ = 0xc0 | code >> 6;
+      *o++ = 0x80 | (code & 0x3f);
+    } else if (code < 0x10000) {
+      *o++ = 0xe0 | code >> 12;
+      *o++ = 0x80 | (code >> 6 & 0x3f);
+      *o++ = 0x80 | (code & 0x3f);
+    } else {
+      *o++ = 0xf0 | code >> 18;
+      *o++ = 0x80 | (code >> 12 & 0x3f);
+      *o++ = 0x80 | (code >> 6 & 0x3f);
+      *o++ = 0x80 | (code & 0x3f);
+    }
+  }
+  if (p < end) {
+    *o++ = *p;
+  }
+  *o = 0;
+  return o - out;
+}
+
+/*
+ * Skip one value of any type. Only the nesting of brackets and the extent of
+ * strings are checked, so the value still has to be parsed before it is used.
+ * Returns the position after the value, or NULL.
+ */
+const char *json_skip_value(const char *p, const char *end) {
+  if (p >= end) {
+    return NULL;
+  }
+  if (*p == '"') {
+    return json_skip_string(p, end);
+  }
+
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = json_skip_string(p, end);
+        if (!p) {
+          return NULL;
+        }
+        continue;
+      }
+      if (*p == '{' || *p == '[') {
+        depth++;
+      } else if ((*p == '}' || *p == ']') && --depth == 0) {
+        return p + 1;
+      }
+      p++;
+    }
+    return NULL;
+  }
+
+  const char *start = p;
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+    p++;
+  }
+  return p > start ? p : NULL;
+}
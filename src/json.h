@@ -0,0 +1,12 @@
+#ifndef JSON_H
+#define JSON_H
+
+void json_write_string(FILE *f, char *str);
+void json_write(FILE *f, cJSON *node, int depth);
+void json_indent(FILE *f, int depth);
+const char *json_skip_space(const char *p, const char *end);
+const char *json_skip_string(const char *p, const char *end);
+size_t json_decode_string(const char *p, size_t length, char *out);
+const char *json_skip_value(const char *p, const char *end);
+
+#endif
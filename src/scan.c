@@ -0,0 +1,397 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+#include "scan.h"
+
+/*
+ * Texts are scanned this many bytes at a time, giving one bit per byte
+ */
+#define BLOCK 64
+
+/*
+ * The bytes each block is compared against. A line of a text starts after a
+ * newline, a line of an escaped JSON string after the 'n' of a "\n", and the
+ * status markers are in the same places in both lists.
+ */
+#define CLASSES 9
+
+static const char text_needles[CLASSES] = "\n +o-x!";
+static const char escaped_needles[CLASSES] = "\\ +o-x!nu";
+
+enum { BREAK, SPACE, GREEN, YELLOW, RED, BLUE, IMPORTANT, LETTER_N, LETTER_U };
+
+#define ODD_BITS 0xaaaaaaaaaaaaaaaaULL
+
+/*
+ * The scanning loops are written once and compiled into each engine with its
+ * match() inlined, so that every engine also gets the instructions of its
+ * target for the bookkeeping
+ */
+#define INLINE static inline __attribute__((always_inline))
+
+/*
+ * Set bit i of masks[k] if p[i] is needles[k], for each of the needles and
+ * the BLOCK bytes at 'p'
+ */
+typedef void (*match_fn)(const char *p, const char *needles, uint64_t *masks);
+
+#ifdef SCAN_X86
+__attribute__((target("sse2"))) INLINE uint64_t equal_sse2(__m128i *v, char c) {
+  __m128i repeated = _mm_set1_epi8(c);
+  uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[0], repeated));
+  uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[1], repeated));
+  uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[2], repeated));
+  uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[3], repeated));
+  return m3 << 48 | m2 << 32 | m1 << 16 | m0;
+}
+
+__attribute__((target("sse2"))) INLINE void match_sse2(const char *p, const char *needles, uint64_t *masks) {
+  __m128i v[4];
+  for (int i = 0; i < 4; i++) {
+    v[i] = _mm_loadu_si128((const __m128i *)(p + i * 16));
+  }
+  masks[0] = equal_sse2(v, needles[0]);
+  masks[1] = equal_sse2(v, needles[1]);
+  masks[2] = equal_sse2(v, needles[2]);
+  masks[3] = equal_sse2(v, needles[3]);
+  masks[4] = equal_sse2(v, needles[4]);
+  masks[5] = equal_sse2(v, needles[5]);
+  masks[6] = equal_sse2(v, needles[6]);
+  masks[7] = equal_sse2(v, needles[7]);
+  masks[8] = equal_sse2(v, needles[8]);
+}
+
+__attribute__((target("avx2"))) INLINE uint64_t equal_avx2(__m256i low, __m256i high, char c) {
+  __m256i repeated = _mm256_set1_epi8(c);
+  uint32_t low_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, repeated));
+  uint32_t high_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, repeated));
+  return (uint64_t)high_mask << 32 | low_mask;
+}
+
+__attribute__((target("avx2"))) INLINE void match_avx2(const char *p, const char *needles, uint64_t *masks) {
+  __m256i low = _mm256_loadu_si256((const __m256i *)p);
+  __m256i high = _mm256_loadu_si256((const __m256i *)(p + 32));
+  masks[0] = equal_avx2(low, high, needles[0]);
+  masks[1] = equal_avx2(low, high, needles[1]);
+  masks[2] = equal_avx2(low, high, needles[2]);
+  masks[3] = equal_avx2(low, high, needles[3]);
+  masks[4] = equal_avx2(low, high, needles[4]);
+  masks[5] = equal_avx2(low, high, needles[5]);
+  masks[6] = equal_avx2(low, high, needles[6]);
+  masks[7] = equal_avx2(low, high, needles[7]);
+  masks[8] = equal_avx2(low, high, needles[8]);
+}
+#endif
+
+/*
+ * match() for the block at 'p', which may run past 'end'. Nothing past 'end'
+ * is read and it matches nothing.
+ */
+INLINE void block(match_fn match, const char *p, const char *end, const char *needles, uint64_t *masks) {
+  if (end - p >= BLOCK) {
+    match(p, needles, masks);
+  } else {
+    char tail[BLOCK] = {0};
+    memcpy(tail, p, end - p);
+    match(tail, needles, masks);
+  }
+}
+
+/*
+ * The byte after the block at 'p', or 0 at the end
+ */
+INLINE char after(const char *p, const char *end) {
+  return p + BLOCK < end ? p[BLOCK] : 0;
+}
+
+/*
+ * Add up the markers of the lines starting at the bits of 'starts' in a
+ * block, given whether the byte after the block is a space, and return the
+ * task flags they carry
+ */
+INLINE int markers(uint64_t starts, uint64_t *masks, int space_after, int *green, int *yellow, int *red, int *blue) {
+  uint64_t marked = starts & (masks[SPACE] >> 1 | (uint64_t)space_after << 63);
+  if (marked) {
+    *green += __builtin_popcountll(marked & masks[GREEN]);
+    *yellow += __builtin_popcountll(marked & masks[YELLOW]);
+    *red += __builtin_popcountll(marked & masks[RED]);
+    *blue += __builtin_popcountll(marked & masks[BLUE]);
+  }
+  return (starts & masks[YELLOW] ? TASK_INCOMPLETE : 0) | (starts & masks[IMPORTANT] ? TASK_IMPORTANT : 0);
+}
+
+INLINE int scan_text(match_fn match, const char *str, int *lines, int *green, int *yellow, int *red, int *blue) {
+  const char *end = str + strlen(str);
+  uint64_t masks[CLASSES];
+  uint64_t carry = 1;
+  int tasks = 0;
+  for (const char *p = str; p < end; p += BLOCK) {
+    block(match, p, end, text_needles, masks);
+    uint64_t starts = masks[BREAK] << 1 | carry;
+    carry = masks[BREAK] >> 63;
+    *lines += __builtin_popcountll(masks[BREAK]);
+    tasks |= markers(starts, masks, after(p, end) == ' ', green, yellow, red, blue);
+  }
+  return tasks;
+}
+
+/*
+ * Read one character of an escaped JSON string and advance past it. Only
+ * ASCII matters to the counters below, so any other character comes back as
+ * 0x80.
+ */
+static int unescape(const char **p, const char *end) {
+  const char *s = *p;
+  if (*s != '\\') {
+    *p = s + 1;
+    return (unsigned char)*s < 0x80 ? *s : 0x80;
+  }
+  if (s + 1 >= end) {
+    *p = end;
+    return 0x80;
+  }
+
+  *p = s + 2;
+  switch (s[1]) {
+  case 'b':
+    return '\b';
+  case 'f':
+    return '\f';
+  case 'n':
+    return '\n';
+  case 'r':
+    return '\r';
+  case 't':
+    return '\t';
+  case 'u':
+    if (s + 6 <= end) {
+      char hex[5] = {s[2], s[3], s[4], s[5], 0};
+      long c = strtol(hex, NULL, 16);
+      *p = s + 6;
+      return c < 0x80 ? c : 0x80;
+    }
+    return 0x80;
+  default:
+    return s[1];
+  }
+}
+
+/*
+ * Count the status marker of a line of a JSON string that is still escaped,
+ * and return the task flag it carries
+ */
+static int classify_escaped(const char *line, const char *end, int *green, int *yellow, int *red, int *blue) {
+  const char *p = line;
+  int marker = p < end ? unescape(&p, end) : 0;
+  if (marker != '\n' && p < end && unescape(&p, end) == ' ') {
+    *green += marker == '+';
+    *yellow += marker == 'o';
+    *red += marker == '-';
+    *blue += marker == 'x';
+  }
+  return marker == 'o' ? TASK_INCOMPLETE : marker == '!' ? TASK_IMPORTANT : 0;
+}
+
+/*
+ * A character is escaped if it follows an odd run of backslashes, which the
+ * subtraction below finds for a whole block at once: it carries through each
+ * run and leaves the bit after it set when the run starts on an even bit and
+ * has odd length, or the other way round. Lines that start with an escape,
+ * and the rare "\u000a", are read one character at a time.
+ */
+INLINE int scan_escaped(match_fn match, const char *str, size_t length, int *lines, int *green, int *yellow, int *red,
+                        int *blue) {
+  const char *end = str + length;
+  uint64_t masks[CLASSES];
+  uint64_t carry = 1;
+  uint64_t escaping = 0;
+  int tasks = 0;
+  for (const char *p = str; p < end; p += BLOCK) {
+    block(match, p, end, escaped_needles, masks);
+    uint64_t backslashes = masks[BREAK] & ~escaping;
+    uint64_t runs = ((backslashes << 1 | ODD_BITS) - backslashes) ^ ODD_BITS;
+    uint64_t escaped = runs ^ (backslashes | escaping);
+    escaping = (runs & backslashes) >> 63;
+
+    uint64_t breaks = escaped & masks[LETTER_N];
+    uint64_t starts = breaks << 1 | carry;
+    carry = breaks >> 63;
+    *lines += __builtin_popcountll(breaks);
+
+    for (uint64_t u = escaped & masks[LETTER_U]; u; u &= u - 1) {
+      const char *s = p + __builtin_ctzll(u) - 1;
+      if (unescape(&s, end) == '\n') {
+        (*lines)++;
+        tasks |= classify_escaped(s, end, green, yellow, red, blue);
+      }
+    }
+
+    char next = after(p, end);
+    uint64_t slow = starts & (masks[BREAK] | masks[BREAK] >> 1 | (uint64_t)(next == '\\') << 63);
+    for (uint64_t bits = slow; bits; bits &= bits - 1) {
+      tasks |= classify_escaped(p + __builtin_ctzll(bits), end, green, yellow, red, blue);
+    }
+    tasks |= markers(starts & ~slow, masks, next == ' ', green, yellow, red, blue);
+  }
+  return tasks;
+}
+
+typedef int (*text_fn)(const char *str, int *lines, int *green, int *yellow, int *red, int *blue);
+typedef int (*escaped_fn)(const char *str, size_t length, int *lines, int *green, int *yellow, int *red, int *blue);
+
+/*
+ * Without vector instructions a 64-bit word only holds eight bytes, and
+ * comparing them against every needle costs more than it saves, so the
+ * portable engine walks the text a line at a time with strchr() and memchr()
+ * instead
+ */
+static int text_portable(const char *str, int *lines, int *green, int *yellow, int *red, int *blue) {
+  int tasks = 0;
+  for (const char *line = str;;) {
+    if (*line && line[1] == ' ') {
+      *green += *line == '+';
+      *yellow += *line == 'o';
+      *red += *line == '-';
+      *blue += *line == 'x';
+    }
+    tasks |= *line == 'o' ? TASK_INCOMPLETE : *line == '!' ? TASK_IMPORTANT : 0;
+
+    const char *next = strchr(line, '\n');
+    if (!next) {
+      return tasks;
+    }
+    (*lines)++;
+    line = next + 1;
+  }
+}
+
+/*
+ * Only escape sequences can be newlines, so the scan jumps from one backslash
+ * to the next
+ */
+static int escaped_portable(const char *str, size_t length, int *lines, int *green, int *yellow, int *red, int *blue) {
+  const char *end = str + length;
+  const char *line = str;
+  int tasks = 0;
+  for (;;) {
+    tasks |= classify_escaped(line, end, green, yellow, red, blue);
+
+    const char *next = NULL;
+    for (const char *p = line; p < end && (p = memchr(p, '\\', end - p));) {
+      if (unescape(&p, end) == '\n') {
+        next = p;
+        break;
+      }
+    }
+    if (!next) {
+      return tasks;
+    }
+    (*lines)++;
+    line = next;
+  }
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2"))) static int text_sse2(const char *str, int *lines, int *green, int *yellow, int *red,
+                                                      int *blue) {
+  return scan_text(match_sse2, str, lines, green, yellow, red, blue);
+}
+
+__attribute__((target("sse2"))) static int escaped_sse2(const char *str, size_t length, int *lines, int *green,
+                                                         int *yellow, int *red, int *blue) {
+  return scan_escaped(match_sse2, str, length, lines, green, yellow, red, blue);
+}
+
+__attribute__((target("avx2,popcnt"))) static int text_avx2(const char *str, int *lines, int *green, int *yellow,
+                                                             int *red, int *blue) {
+  return scan_text(match_avx2, str, lines, green, yellow, red, blue);
+}
+
+__attribute__((target("avx2,popcnt"))) static int escaped_avx2(const char *str, size_t length, int *lines, int *green,
+                                                                int *yellow, int *red, int *blue) {
+  return scan_escaped(match_avx2, str, length, lines, green, yellow, red, blue);
+}
+#endif
+
+/*
+ * The engines, best first
+ */
+static struct {
+  const char *name;
+  text_fn text;
+  escaped_fn escaped;
+} engines[] = {
+#ifdef SCAN_X86
+    {"avx2", text_avx2, escaped_avx2},
+    {"sse2", text_sse2, escaped_sse2},
+#endif
+    {"portable", text_portable, escaped_portable},
+};
+
+static int engine = -1;
+
+static int supported(const char *name) {
+#ifdef SCAN_X86
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  }
+  if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return 1;
+}
+
+/*
+ * Use the engine called 'name', or the best one this CPU supports if 'name'
+ * is NULL. Returns 0 on success.
+ */
+int scan_select(const char *name) {
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+    if ((!name || strcmp(name, engines[i].name) == 0) && supported(engines[i].name)) {
+      engine = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * The name of the engine in use
+ */
+const char *scan_engine() {
+  if (engine < 0) {
+    scan_select(NULL);
+  }
+  return engines[engine].name;
+}
+
+/*
+ * Count the lines of a string, and the lines that are prepended with a '+',
+ * 'o', '-' or 'x', in one pass. The counts are added to the appropriate args.
+ * Returns TASK_INCOMPLETE if a line starts with 'o' and TASK_IMPORTANT if one
+ * starts with '!'.
+ */
+int count_tasks(const char *str, int *lines, int *green, int *yellow, int *red, int *blue) {
+  if (engine < 0) {
+    scan_select(NULL);
+  }
+  return engines[engine].text(str, lines, green, yellow, red, blue);
+}
+
+/*
+ * The same as count_tasks, taken from the body of a JSON string without
+ * decoding it first
+ */
+int count_escaped(const char *str, size_t length, int *lines, int *green, int *yellow, int *red, int *blue) {
+  if (engine < 0) {
+    scan_select(NULL);
+  }
+  return engines[engine].escaped(str, length, lines, green, yellow, red, blue);
+}
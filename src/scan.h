@@ -0,0 +1,16 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * Returned by count_tasks and count_escaped for a text with a line that
+ * starts with 'o' or '!' respectively
+ */
+#define TASK_INCOMPLETE 1
+#define TASK_IMPORTANT 2
+
+int count_tasks(const char *str, int *lines, int *green, int *yellow, int *red, int *blue);
+int count_escaped(const char *str, size_t length, int *lines, int *green, int *yellow, int *red, int *blue);
+int scan_select(const char *name);
+const char *scan_engine();
+
+#endif
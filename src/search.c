@@ -0,0 +1,163 @@
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+
+#define CHUNK 512
+
+/*
+ * Whether a basic regular expression contains only literal characters. For
+ * such patterns, anything that matches "abc" also matches "ab", so extending
+ * the pattern can only remove matches.
+ */
+static int is_literal(char *pattern) {
+  return strpbrk(pattern, ".[]*^$\\") == NULL;
+}
+
+/*
+ * Make sure the bitmaps cover 'day'. New days start out untested.
+ */
+static void cover(struct search *search, int day) {
+  if (search->size && day >= search->base && day < search->base + search->size) {
+    return;
+  }
+
+  int first = search->size ? search->base : day;
+  int last = search->size ? search->base + search->size : day + 1;
+  if (day < first) {
+    first = day;
+  }
+  if (day >= last) {
+    last = day + 1;
+  }
+  first -= CHUNK + ((first % 8) + 8) % 8;
+  last += CHUNK;
+
+  int size = (last - first + 7) / 8 * 8;
+  unsigned char *tested = calloc(size / 8, 1);
+  unsigned char *matched = calloc(size / 8, 1);
+  if (!tested || !matched) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  if (search->size) {
+    int offset = (search->base - first) / 8;
+    memcpy(tested + offset, search->tested, search->size / 8);
+    memcpy(matched + offset, search->matched, search->size / 8);
+  }
+
+  free(search->tested);
+  free(search->matched);
+  search->tested = tested;
+  search->matched = matched;
+  search->base = first;
+  search->size = size;
+}
+
+/*
+ * Update the search to a new pattern. Nothing is done if the pattern, flags,
+ * and data generation are unchanged. If a literal pattern has only grown,
+ * days that failed to match before are still known to fail, so only the
+ * previous matches are queued for re-testing. Any other change forgets all
+ * results.
+ */
+void search_set(struct search *search, char *pattern, int flags, unsigned long generation) {
+  char *current = search->pattern ? search->pattern : "";
+  int same = strcmp(pattern, current) == 0 && flags == search->flags;
+  if (same && generation == search->generation) {
+    return;
+  }
+
+  int len = strlen(current);
+  int narrowing = len > 0 && flags == search->flags &&
+                  generation == search->generation &&
+                  strncmp(pattern, current, len) == 0 &&
+                  is_literal(pattern);
+
+  for (int i = 0; i < search->size / 8; i++) {
+    if (narrowing) {
+      search->tested[i] &= ~search->matched[i];
+    } else {
+      search->tested[i] = 0;
+    }
+  }
+
+  if (search->compiled) {
+    regfree(&search->preg);
+  }
+  search->compiled = pattern[0] && regcomp(&search->preg, pattern, flags) == 0;
+
+  if (!same) {
+    char *copy = malloc(strlen(pattern) + 1);
+    if (!copy) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    strcpy(copy, pattern);
+    free(search->pattern);
+    search->pattern = copy;
+    search->serial++;
+  }
+  search->flags = flags;
+  search->generation = generation;
+}
+
+/*
+ * Whether the text for a day matches the current search. Results are cached
+ * per day until the pattern or the data changes. An empty or invalid pattern
+ * matches nothing.
+ */
+int search_match(struct search *search, int day, char *str) {
+  if (!search->compiled) {
+    return 0;
+  }
+
+  cover(search, day);
+
+  int bit = day - search->base;
+  unsigned char mask = 1 << (bit % 8);
+  if (!(search->tested[bit / 8] & mask)) {
+    search->tested[bit / 8] |= mask;
+    if (regexec(&search->preg, str, 0, NULL, 0) == 0) {
+      search->matched[bit / 8] |= mask;
+    } else {
+      search->matched[bit / 8] &= ~mask;
+    }
+  }
+
+  return (search->matched[bit / 8] & mask) != 0;
+}
+
+/*
+ * Record the result of testing a day against the current search elsewhere, so
+ * that search_match() need not test it again
+ */
+void search_mark(struct search *search, int day, int matched) {
+  if (!search->compiled) {
+    return;
+  }
+
+  cover(search, day);
+
+  int bit = day - search->base;
+  unsigned char mask = 1 << (bit % 8);
+  search->tested[bit / 8] |= mask;
+  if (matched) {
+    search->matched[bit / 8] |= mask;
+  } else {
+    search->matched[bit / 8] &= ~mask;
+  }
+}
+
+void search_free(struct search *search) {
+  if (search->compiled) {
+    regfree(&search->preg);
+  }
+  free(search->pattern);
+  free(search->tested);
+  free(search->matched);
+  memset(search, 0, sizeof(struct search));
+}
@@ -0,0 +1,28 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+/*
+ * The compiled form of the current search, along with a bitmap of which days
+ * have already been tested against it and which of those matched. 'serial'
+ * counts the changes of pattern or flags, so that whoever shows the results
+ * can tell whether they are still current without keeping the pattern.
+ */
+struct search {
+  char *pattern;
+  int flags;
+  unsigned long serial;
+  int compiled;
+  regex_t preg;
+  unsigned long generation;
+  int base;
+  int size;
+  unsigned char *tested;
+  unsigned char *matched;
+};
+
+void search_set(struct search *search, char *pattern, int flags, unsigned long generation);
+int search_match(struct search *search, int day, char *str);
+void search_mark(struct search *search, int day, int matched);
+void search_free(struct search *search);
+
+#endif
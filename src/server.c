@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+#define MAX_ARGS 256
+
+/*
+ * Seconds a client may take to send its whole request, and to take the whole
+ * reply, before it is dropped, so that a stuck or slow client cannot hold up
+ * the calendar it is talking to
+ */
+#define TIMEOUT 5
+
+/*
+ * Seconds a client waits for the calendar to answer. An open calendar does not
+ * answer while it waits for the editor or the print command.
+ */
+#define REPLY_TIMEOUT 30
+
+static int address(char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/*
+ * The monotonic clock in milliseconds, which deadlines are given in
+ */
+static long long clock_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Wait until 'fd' is ready for 'events' or has hung up. Returns 0 when it is,
+ * and -1 with errno set to ETIMEDOUT once 'deadline' has passed.
+ */
+static int wait_for(int fd, short events, long long deadline) {
+  while (1) {
+    long long left = deadline - clock_ms();
+    struct pollfd pfd = {fd, events, 0};
+    int n = left > 0 ? poll(&pfd, 1, left) : 0;
+    if (n > 0) {
+      return 0;
+    }
+    if (n == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+/*
+ * Read until end of file into a buffer to be freed by the caller, with a NUL
+ * byte after the data. The reads never block, and all of them together must
+ * be done by 'deadline'. Returns 0 on success.
+ */
+static int read_all(int fd, char **buffer, size_t *size, long long deadline) {
+  size_t capacity = 4096;
+  *buffer = malloc(capacity);
+  *size = 0;
+  while (*buffer) {
+    if (*size + 1 == capacity) {
+      char *grown = realloc(*buffer, capacity * 2);
+      if (!grown) {
+        break;
+      }
+      *buffer = grown;
+      capacity *= 2;
+    }
+    if (wait_for(fd, POLLIN, deadline) != 0) {
+      (*buffer)[*size] = 0;
+      return -1;
+    }
+    ssize_t n = recv(fd, *buffer + *size, capacity - *size - 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if (n <= 0) {
+      (*buffer)[*size] = 0;
+      return n < 0 ? -1 : 0;
+    }
+    *size += n;
+  }
+  free(*buffer);
+  *buffer = NULL;
+  errno = ENOMEM;
+  return -1;
+}
+
+/*
+ * Send a whole buffer by 'deadline', without blocking. A peer that went away
+ * is reported as an error rather than with SIGPIPE.
+ */
+static int send_all(int fd, const char *p, size_t size, long long deadline) {
+  while (size) {
+    if (wait_for(fd, POLLOUT, deadline) != 0) {
+      return -1;
+    }
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+/*
+ * Listen on a socket at 'path' that only the current user can connect to. The
+ * caller must already own the path, as anything there is removed. Returns the
+ * descriptor, or -1.
+ */
+int server_listen(char *path) {
+  struct sockaddr_un addr;
+  if (address(path, &addr) != 0) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  unlink(path);
+  mode_t mask = umask(0077);
+  int failed = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0;
+  umask(mask);
+  if (failed) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Accept a connection on 'listener' and read the request. On success the verb
+ * and its arguments are in 'argv', its input can be read from 'in', and what
+ * is written to 'out' and 'err' is sent back by server_reply(). Returns 0 on
+ * success.
+ */
+int server_accept(int listener, struct request *request) {
+  memset(request, 0, sizeof(struct request));
+  request->fd = accept(listener, NULL, NULL);
+  if (request->fd < 0) {
+    return -1;
+  }
+  fcntl(request->fd, F_SETFD, FD_CLOEXEC);
+
+  size_t size;
+  if (read_all(request->fd, &request->buffer, &size, clock_ms() + TIMEOUT * 1000) != 0) {
+    goto fail;
+  }
+
+  /*
+   * A client that gave up waiting has already told its user that the
+   * request failed, so it is not run late
+   */
+  struct pollfd hangup = {request->fd, 0, 0};
+  if (poll(&hangup, 1, 0) > 0 && hangup.revents & (POLLHUP | POLLERR)) {
+    goto fail;
+  }
+
+  char *p = request->buffer;
+  char *end = request->buffer + size;
+  char *next = memchr(p, 0, end - p);
+  long argc = next ? strtol(p, NULL, 10) : 0;
+  if (argc < 1 || argc > MAX_ARGS) {
+    goto fail;
+  }
+
+  request->argv = calloc(argc + 1, sizeof(char *));
+  for (request->argc = 0; request->argc < argc; request->argc++) {
+    p = next + 1;
+    next = p < end ? memchr(p, 0, end - p) : NULL;
+    if (!next) {
+      goto fail;
+    }
+    request->argv[request->argc] = p;
+  }
+
+  p = next + 1;
+  request->in = p < end ? fmemopen(p, end - p, "r") : fopen("/dev/null", "r");
+  request->out = open_memstream(&request->out_text, &request->out_size);
+  request->err = open_memstream(&request->err_text, &request->err_size);
+  if (!request->in || !request->out || !request->err) {
+    goto fail;
+  }
+  return 0;
+
+fail:
+  server_reply(request);
+  return -1;
+}
+
+/*
+ * Send what the verb wrote back to the client and end the request
+ */
+void server_reply(struct request *request) {
+  if (request->in) {
+    fclose(request->in);
+  }
+  if (request->out) {
+    fclose(request->out);
+  }
+  if (request->err) {
+    fclose(request->err);
+  }
+
+  if (request->out && request->err) {
+    char header[64];
+    int n = snprintf(header, sizeof(header), "%zu %zu\n", request->out_size, request->err_size);
+    long long deadline = clock_ms() + TIMEOUT * 1000;
+    if (send_all(request->fd, header, n, deadline) == 0 &&
+        send_all(request->fd, request->out_text, request->out_size, deadline) == 0) {
+      send_all(request->fd, request->err_text, request->err_size, deadline);
+    }
+  }
+
+  close(request->fd);
+  free(request->out_text);
+  free(request->err_text);
+  free(request->argv);
+  free(request->buffer);
+  memset(request, 0, sizeof(struct request));
+}
+
+/*
+ * Send a verb and its arguments to the server at 'path', followed by 'input',
+ * and copy the reply to 'out' and 'err'. Nothing is sent unless the server
+ * runs as the current user. Returns -1 if no server is listening, 0 if it
+ * answered, and 1 if it did not answer in time or could not be trusted, in
+ * which case the verb may not have been run.
+ */
+int server_forward(char *path, int argc, char *argv[], char *input, size_t input_size, FILE *out, FILE *err) {
+  struct sockaddr_un addr;
+  if (address(path, &addr) != 0) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  struct ucred peer;
+  socklen_t length = sizeof(peer);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 || peer.uid != getuid()) {
+    fprintf(err, "The calendar at \"%s\" is run by another user.\n", path);
+    close(fd);
+    return 1;
+  }
+
+  long long deadline = clock_ms() + REPLY_TIMEOUT * 1000;
+  char count[16];
+  int failed = send_all(fd, count, snprintf(count, sizeof(count), "%d", argc) + 1, deadline) != 0;
+  for (int i = 0; i < argc && !failed; i++) {
+    failed = send_all(fd, argv[i], strlen(argv[i]) + 1, deadline) != 0;
+  }
+  if (!failed && input) {
+    failed = send_all(fd, input, input_size, deadline) != 0;
+  }
+  shutdown(fd, SHUT_WR);
+
+  char *reply = NULL;
+  size_t size = 0;
+  size_t out_size;
+  size_t err_size;
+  failed = failed || read_all(fd, &reply, &size, deadline) != 0;
+  int timed_out = failed && errno == ETIMEDOUT;
+  char *body = failed ? NULL : memchr(reply, '\n', size);
+  failed = !body || sscanf(reply, "%zu %zu", &out_size, &err_size) != 2 ||
+           body + 1 + out_size + err_size != reply + size;
+  if (timed_out) {
+    fprintf(err, "The calendar at \"%s\" did not answer within %d seconds, so the request was dropped. It may be "
+                 "waiting for the editor or the print command.\n", path, REPLY_TIMEOUT);
+  } else if (failed) {
+    fprintf(err, "No reply from the calendar at \"%s\".\n", path);
+  } else {
+    fwrite(body + 1, 1, out_size, out);
+    fwrite(body + 1 + out_size, 1, err_size, err);
+  }
+  free(reply);
+  close(fd);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * CLI verbs can be handed to a running instance over a Unix socket. A request
+ * is the number of strings in decimal and the strings themselves, the verb
+ * first, each followed by a NUL byte, and then the input for the verb until
+ * the client shuts down its side. The reply is a "<out> <err>\n" line with the
+ * sizes of the verb's output and error output, followed by both.
+ */
+struct request {
+  int fd;
+  int argc;
+  char **argv;
+  char *buffer;
+  FILE *in;
+  FILE *out;
+  FILE *err;
+  char *out_text;
+  size_t out_size;
+  char *err_text;
+  size_t err_size;
+};
+
+int server_listen(char *path);
+int server_accept(int listener, struct request *request);
+void server_reply(struct request *request);
+int server_forward(char *path, int argc, char *argv[], char *input, size_t input_size, FILE *out, FILE *err);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#define SHA256_LEN 32
+
+void sha256(const void *data, size_t len, unsigned char *digest);
+void sha256_hex(const unsigned char *digest, char *hex);
+
+#endif
@@ -0,0 +1,370 @@
+#include <cjson/cJSON.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "date.h"
+#include "file.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include "store.h"
+
+#define MAGIC "TCSNAP\n"
+#define BYTE_ORDER_MARK 0x01020304
+
+/*
+ * The flags of a row that describe the calendar file rather than the session
+ */
+#define ROW_FLAGS \
+  (STORE_PRESENT | STORE_MASK | STORE_HASHED | STORE_RAW | STORE_ENCODED | STORE_INCOMPLETE | STORE_IMPORTANT)
+
+/*
+ * The file starts with this header, in the byte order of the machine that
+ * wrote it. The string table holds the unformatted JSON of everything but the
+ * dated entries and is followed by one row per dated entry, in day order.
+ * 'body_crc' covers everything after the header.
+ */
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_nsec;
+  uint32_t crc;
+  uint32_t body_crc;
+  uint64_t strings;
+  uint64_t strings_length;
+  uint64_t rows;
+  uint64_t row_count;
+};
+
+/*
+ * Where a dated entry is in the calendar file and what it adds up to. The
+ * offsets are those of the store's 'span' and 'raw' columns.
+ */
+struct row {
+  int32_t day;
+  uint32_t flags;
+  int32_t lines;
+  int32_t green;
+  int32_t yellow;
+  int32_t red;
+  int32_t blue;
+  int32_t mask;
+  uint64_t span;
+  uint64_t raw;
+  int32_t span_length;
+  int32_t raw_length;
+  unsigned char digest[SHA256_LEN];
+};
+
+static int snapshot_path(char *calendar, char *path) {
+  return snprintf(path, PATH_MAX, "%s.snap", calendar) < PATH_MAX;
+}
+
+/*
+ * CRC-32 of a buffer of any size
+ */
+static uint32_t checksum(const char *p, size_t size) {
+  uLong crc = crc32(0, Z_NULL, 0);
+  while (size) {
+    uInt chunk = size > (1u << 30) ? 1u << 30 : size;
+    crc = crc32(crc, (const Bytef *)p, chunk);
+    p += chunk;
+    size -= chunk;
+  }
+  return crc;
+}
+
+static int same_file(struct header *header, struct stat *st) {
+  return header->size == (uint64_t)st->st_size && header->mtime == st->st_mtim.tv_sec &&
+         header->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Map a snapshot and check that it is one this build can read and that it is
+ * intact. Returns the header, or NULL. The descriptor is kept open in '*fd'
+ * so that a writable mapping can be locked.
+ */
+static struct header *map(char *path, int writable, int *fd, size_t *size) {
+  *fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if (*fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  struct header *header = MAP_FAILED;
+  if (fstat(*fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct header)) {
+    *size = st.st_size;
+    header = mmap(NULL, *size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, *fd, 0);
+  }
+  if (header == MAP_FAILED) {
+    close(*fd);
+    return NULL;
+  }
+
+  char *image = (char *)header;
+  int valid = memcmp(header->magic, MAGIC, sizeof(header->magic)) == 0 && header->version == SNAPSHOT_VERSION &&
+              header->byte_order == BYTE_ORDER_MARK;
+  valid = valid && header->strings >= sizeof(struct header) && header->strings_length > 0 &&
+          header->strings_length <= *size - header->strings && image[header->strings + header->strings_length - 1] == 0;
+  valid = valid && header->rows % sizeof(uint64_t) == 0 && header->rows >= sizeof(struct header) &&
+          header->rows <= *size && header->row_count <= (*size - header->rows) / sizeof(struct row);
+  valid = valid && checksum(image + sizeof(struct header), *size - sizeof(struct header)) == header->body_crc;
+  if (!valid) {
+    munmap(header, *size);
+    close(*fd);
+    return NULL;
+  }
+  return header;
+}
+
+/*
+ * Fill the store from the snapshot of 'calendar' instead of scanning it. The
+ * store takes over 'buffer', the calendar file described by 'st' that is
+ * mapped if 'mapped' is set, only if the snapshot was made from that file.
+ * Returns the tree of everything but the dated entries, or NULL if there is no
+ * usable snapshot.
+ */
+cJSON *snapshot_load(char *calendar, struct store *store, char *buffer, int mapped, struct stat *st) {
+  char path[PATH_MAX];
+  int fd;
+  size_t size;
+  struct header *header = snapshot_path(calendar, path) ? map(path, 0, &fd, &size) : NULL;
+  if (!header) {
+    return NULL;
+  }
+  close(fd);
+
+  /*
+   * A file that was touched or copied without being changed keeps its
+   * snapshot, which is then tagged with the new time
+   */
+  int retag = 0;
+  if (!same_file(header, st)) {
+    retag = header->size == (uint64_t)st->st_size && checksum(buffer, st->st_size) == header->crc;
+    if (!retag) {
+      munmap(header, size);
+      return NULL;
+    }
+  }
+
+  char *image = (char *)header;
+  struct row *rows = (struct row *)(image + header->rows);
+  uint64_t count = header->row_count;
+  uint64_t source_size = st->st_size;
+  int first = days_from_civil(0, 1, 1) - 1;
+  for (uint64_t i = 0; i < count; i++) {
+    struct row *row = &rows[i];
+    int valid = row->day > first && row->day <= days_from_civil(9999, 12, 31) &&
+                (row->flags & (STORE_PRESENT | STORE_RAW)) == (STORE_PRESENT | STORE_RAW) && row->span_length > 0 &&
+                row->span <= source_size && row->span_length <= source_size - row->span;
+    if (valid && (row->flags & STORE_ENCODED)) {
+      valid = row->raw > 0 && row->raw_length >= 0 && row->raw + row->raw_length < source_size;
+    }
+    if (!valid) {
+      munmap(header, size);
+      return NULL;
+    }
+    first = row->day;
+  }
+
+  cJSON *root = cJSON_Parse(image + header->strings);
+  if (!cJSON_IsObject(root)) {
+    cJSON_Delete(root);
+    munmap(header, size);
+    return NULL;
+  }
+
+  store_attach(store, buffer, st->st_size, mapped, count ? rows[0].day : 0, count ? rows[count - 1].day : -1);
+  for (uint64_t i = 0; i < count; i++) {
+    struct row *row = &rows[i];
+    int r = row->day - store->base;
+    store->flags[r] = row->flags & ROW_FLAGS;
+    store->lines[r] = row->lines;
+    store->green[r] = row->green;
+    store->yellow[r] = row->yellow;
+    store->red[r] = row->red;
+    store->blue[r] = row->blue;
+    store->mask[r] = row->mask;
+    store->span[r] = row->span;
+    store->span_length[r] = row->span_length;
+    store->raw[r] = row->raw;
+    store->raw_length[r] = row->raw_length;
+    if (row->flags & STORE_HASHED) {
+      memcpy(store->digest[r], row->digest, SHA256_LEN);
+    }
+    if (row->flags & STORE_ENCODED) {
+      store->summary.green += row->green;
+      store->summary.yellow += row->yellow;
+      store->summary.red += row->red;
+      store->summary.blue += row->blue;
+    }
+  }
+  store_index(store);
+  munmap(header, size);
+
+  if (retag) {
+    snapshot_write(calendar, store, root, st);
+  }
+  return root;
+}
+
+/*
+ * Write a snapshot of the calendar file described by 'st', which must be the
+ * one the store was just loaded from, with 'root' the tree store_load()
+ * returned for it. Returns 0 on success.
+ */
+int snapshot_write(char *calendar, struct store *store, cJSON *root, struct stat *st) {
+  char path[PATH_MAX];
+  if (!snapshot_path(calendar, path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  uint64_t count = 0;
+  for (int i = 0; i < store->rows; i++) {
+    if (!(store->flags[i] & STORE_PRESENT)) {
+      continue;
+    }
+    if (!(store->flags[i] & STORE_RAW)) {
+      errno = EINVAL;
+      return -1;
+    }
+    count++;
+  }
+
+  char *strings = cJSON_PrintUnformatted(root);
+  if (!strings) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  struct header header = {0};
+  memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.size = st->st_size;
+  header.mtime = st->st_mtim.tv_sec;
+  header.mtime_nsec = st->st_mtim.tv_nsec;
+  header.crc = checksum(store->source, store->source_size);
+  header.strings = sizeof(struct header);
+  header.strings_length = strlen(strings) + 1;
+  header.rows = (header.strings + header.strings_length + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  header.row_count = count;
+
+  size_t size = header.rows + count * sizeof(struct row);
+  char *image = calloc(1, size);
+  if (!image) {
+    free(strings);
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(image + header.strings, strings, header.strings_length);
+  free(strings);
+
+  struct row *row = (struct row *)(image + header.rows);
+  for (int i = 0; i < store->rows; i++) {
+    unsigned short flags = store->flags[i];
+    if (!(flags & STORE_PRESENT)) {
+      continue;
+    }
+    if (flags & STORE_DATA) {
+      flags = (flags & ~STORE_DATA) | STORE_ENCODED;
+    }
+    row->day = store->base + i;
+    row->flags = flags & ROW_FLAGS;
+    row->lines = store->lines[i];
+    row->green = store->green[i];
+    row->yellow = store->yellow[i];
+    row->red = store->red[i];
+    row->blue = store->blue[i];
+    row->mask = store->mask[i];
+    row->span = store->span[i];
+    row->span_length = store->span_length[i];
+    row->raw = store->raw[i];
+    row->raw_length = store->raw_length[i];
+    if (flags & STORE_HASHED) {
+      memcpy(row->digest, store->digest[i], SHA256_LEN);
+    }
+    row++;
+  }
+
+  header.body_crc = checksum(image + sizeof(struct header), size - sizeof(struct header));
+  memcpy(image, &header, sizeof(struct header));
+
+  struct atomic_file file;
+  if (atomic_open(&file, path) != 0) {
+    free(image);
+    return -1;
+  }
+  if (fwrite(image, 1, size, file.f) != size) {
+    atomic_abort(&file);
+    free(image);
+    return -1;
+  }
+  free(image);
+  return atomic_commit(&file);
+}
+
+/*
+ * Copy the backup digests worked out since loading into the snapshot, so that
+ * the next session does not hash the same entries again. Nothing is written
+ * unless the calendar file is still the one described by 'st' and the
+ * snapshot was made from it. Returns the number of rows updated, or -1.
+ */
+int snapshot_update(char *calendar, struct store *store, struct stat *st) {
+  char path[PATH_MAX];
+  struct stat now;
+  if (!snapshot_path(calendar, path) || stat(calendar, &now) != 0) {
+    return -1;
+  }
+  if (now.st_size != st->st_size || now.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+      now.st_mtim.tv_nsec != st->st_mtim.tv_nsec) {
+    return 0;
+  }
+
+  int fd;
+  size_t size;
+  struct header *header = map(path, 1, &fd, &size);
+  if (!header) {
+    return -1;
+  }
+  if (!same_file(header, st) || flock(fd, LOCK_EX) != 0) {
+    munmap(header, size);
+    close(fd);
+    return 0;
+  }
+
+  char *image = (char *)header;
+  struct row *rows = (struct row *)(image + header->rows);
+  int updated = 0;
+  for (uint64_t i = 0; i < header->row_count; i++) {
+    int r = store_row(store, rows[i].day);
+    if (r < 0 || (rows[i].flags & STORE_HASHED)) {
+      continue;
+    }
+    if ((store->flags[r] & (STORE_RAW | STORE_HASHED)) == (STORE_RAW | STORE_HASHED)) {
+      memcpy(rows[i].digest, store->digest[r], SHA256_LEN);
+      rows[i].flags |= STORE_HASHED;
+      updated++;
+    }
+  }
+  if (updated) {
+    header->body_crc = checksum(image + sizeof(struct header), size - sizeof(struct header));
+  }
+
+  munmap(header, size);
+  close(fd);
+  return updated;
+}
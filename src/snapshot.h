@@ -0,0 +1,19 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * A binary copy of what loading the calendar file works out, kept next to it
+ * as "<calendar>.snap". It is tagged with the size, modification time and
+ * CRC-32 of the calendar file it was made from and is only used while they
+ * still match, so the calendar file stays the one source of truth.
+ */
+#define SNAPSHOT_VERSION 2
+
+struct stat;
+struct store;
+
+cJSON *snapshot_load(char *calendar, struct store *store, char *buffer, int mapped, struct stat *st);
+int snapshot_write(char *calendar, struct store *store, cJSON *root, struct stat *st);
+int snapshot_update(char *calendar, struct store *store, struct stat *st);
+
+#endif
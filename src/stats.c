@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *names[STAT_COUNT] = {
+    "load", "version", "curses", "input", "redraw", "refresh", "frame",
+    "save", "backup", "prune", "edit", "index", "merge",
+};
+
+/*
+ * Nanoseconds on the monotonic clock
+ */
+unsigned long long stats_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *stats_name(int stat) { return names[stat]; }
+
+/*
+ * The bucket of a duration. The first STATS_STEPS buckets hold single
+ * nanoseconds, and after that each power of two gets STATS_STEPS buckets.
+ */
+static int bucket(unsigned long long ns) {
+  if (ns < STATS_STEPS) {
+    return ns;
+  }
+  int exponent = 63 - __builtin_clzll(ns);
+  int index = (exponent - 2) * STATS_STEPS + ((ns >> (exponent - 3)) & (STATS_STEPS - 1));
+  return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+/*
+ * The middle of the range of durations that fall in a bucket
+ */
+static unsigned long long middle(int index) {
+  if (index < STATS_STEPS) {
+    return index;
+  }
+  int shift = index / STATS_STEPS - 1;
+  unsigned long long low = (unsigned long long)(STATS_STEPS + index % STATS_STEPS) << shift;
+  return low + (1ULL << shift) / 2;
+}
+
+/*
+ * Add the time since 'start', as returned by stats_clock(), to a histogram
+ */
+void stats_record(struct stats *stats, int stat, unsigned long long start) {
+  unsigned long long ns = stats_clock() - start;
+  struct histogram *histogram = &stats->histograms[stat];
+  if (!histogram->count || ns < histogram->min) {
+    histogram->min = ns;
+  }
+  if (ns > histogram->max) {
+    histogram->max = ns;
+  }
+  histogram->count++;
+  histogram->total += ns;
+  histogram->buckets[bucket(ns)]++;
+}
+
+/*
+ * The duration that 'fraction' of the recorded ones are no longer than
+ */
+unsigned long long stats_percentile(struct histogram *histogram, double fraction) {
+  if (!histogram->count) {
+    return 0;
+  }
+  unsigned long rank = fraction * histogram->count;
+  if (rank >= histogram->count) {
+    rank = histogram->count - 1;
+  }
+  unsigned long seen = 0;
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen > rank) {
+      unsigned long long ns = middle(i);
+      return ns < histogram->min ? histogram->min : ns > histogram->max ? histogram->max : ns;
+    }
+  }
+  return histogram->max;
+}
+
+/*
+ * Write a duration in a unit that keeps it short, into at least 16 bytes
+ */
+void stats_format(unsigned long long ns, char *buf) {
+  if (ns < 1000) {
+    sprintf(buf, "%lluns", ns);
+  } else if (ns < 1000000) {
+    sprintf(buf, "%.1fus", ns / 1e3);
+  } else if (ns < 1000000000) {
+    sprintf(buf, "%.1fms", ns / 1e6);
+  } else {
+    sprintf(buf, "%.2fs", ns / 1e9);
+  }
+}
+
+/*
+ * Print a line per phase that was timed at least once
+ */
+void stats_print(struct stats *stats, FILE *f) {
+  fprintf(f, "%-8s %8s %9s %9s %9s %9s %9s\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+  for (int i = 0; i < STAT_COUNT; i++) {
+    struct histogram *histogram = &stats->histograms[i];
+    if (!histogram->count) {
+      continue;
+    }
+    char mean[16];
+    char p50[16];
+    char p90[16];
+    char p99[16];
+    char max[16];
+    stats_format(histogram->total / histogram->count, mean);
+    stats_format(stats_percentile(histogram, 0.5), p50);
+    stats_format(stats_percentile(histogram, 0.9), p90);
+    stats_format(stats_percentile(histogram, 0.99), p99);
+    stats_format(histogram->max, max);
+    fprintf(f, "%-8s %8lu %9s %9s %9s %9s %9s\n", names[i], histogram->count, mean, p50, p90, p99, max);
+  }
+}
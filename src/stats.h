@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * The timed phases of the program
+ */
+#define STAT_LOAD 0
+#define STAT_VERSION 1
+#define STAT_CURSES 2
+#define STAT_INPUT 3
+#define STAT_REDRAW 4
+#define STAT_REFRESH 5
+#define STAT_FRAME 6
+#define STAT_SAVE 7
+#define STAT_BACKUP 8
+#define STAT_PRUNE 9
+#define STAT_EDIT 10
+#define STAT_INDEX 11
+#define STAT_MERGE 12
+#define STAT_COUNT 13
+
+/*
+ * Durations are counted in buckets that split every power of two nanoseconds
+ * into STATS_STEPS, so a percentile read from them is within 1/STATS_STEPS of
+ * the real value. Anything over 2^40 ns (about 18 minutes) goes in the last.
+ */
+#define STATS_STEPS 8
+#define STATS_BUCKETS ((40 - 2) * STATS_STEPS)
+
+struct histogram {
+  unsigned long count;
+  unsigned long long total;
+  unsigned long long min;
+  unsigned long long max;
+  unsigned long buckets[STATS_BUCKETS];
+};
+
+struct stats {
+  struct histogram histograms[STAT_COUNT];
+};
+
+unsigned long long stats_clock();
+const char *stats_name(int stat);
+void stats_record(struct stats *stats, int stat, unsigned long long start);
+unsigned long long stats_percentile(struct histogram *histogram, double fraction);
+void stats_format(unsigned long long ns, char *buf);
+void stats_print(struct stats *stats, FILE *f);
+
+#endif
@@ -0,0 +1,851 @@
+#include <cjson/cJSON.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "date.h"
+#include "json.h"
+#include "scan.h"
+#include "store.h"
+#include "util.h"
+
+#define GROWTH 366
+#define WORD_BITS 64
+
+/*
+ * Resize one column to 'rows' entries, with 'shift' empty entries inserted in
+ * front of the existing ones
+ */
+static void *resize(void *column, size_t width, int old_rows, int rows, int shift) {
+  char *new = calloc(rows, width);
+  if (!new) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  if (column) {
+    memcpy(new + shift * width, column, old_rows * width);
+  }
+  free(column);
+  return new;
+}
+
+/*
+ * Bring a row's bits in the day bitmaps in line with its flags
+ */
+static void index_row(struct store *store, int row) {
+  unsigned long long bit = 1ULL << (row % WORD_BITS);
+  unsigned short flags = store->flags[row];
+  int text = flags & (STORE_DATA | STORE_ENCODED);
+
+  store->present[row / WORD_BITS] &= ~bit;
+  store->full[row / WORD_BITS] &= ~bit;
+  if (flags & STORE_PRESENT) {
+    store->present[row / WORD_BITS] |= bit;
+    if (!text || store->lines[row] >= STORE_SHORT_LINES) {
+      store->full[row / WORD_BITS] |= bit;
+    }
+  }
+}
+
+/*
+ * Make sure there is a row for 'day'. The table grows by at least a year at a
+ * time in whichever direction is needed.
+ */
+static void cover(struct store *store, int day) {
+  if (store->rows && day >= store->base && day < store->base + store->rows) {
+    return;
+  }
+
+  int first = store->rows ? store->base : day;
+  int last = store->rows ? store->base + store->rows : day + 1;
+  if (day < first) {
+    first = day - GROWTH;
+  }
+  if (day >= last) {
+    last = day + GROWTH;
+  }
+
+  int rows = last - first;
+  int shift = store->rows ? store->base - first : 0;
+  int old = store->rows;
+
+  store->offset = resize(store->offset, sizeof(size_t), old, rows, shift);
+  store->length = resize(store->length, sizeof(int), old, rows, shift);
+  store->lines = resize(store->lines, sizeof(int), old, rows, shift);
+  store->green = resize(store->green, sizeof(int), old, rows, shift);
+  store->yellow = resize(store->yellow, sizeof(int), old, rows, shift);
+  store->red = resize(store->red, sizeof(int), old, rows, shift);
+  store->blue = resize(store->blue, sizeof(int), old, rows, shift);
+  store->mask = resize(store->mask, sizeof(int), old, rows, shift);
+  store->flags = resize(store->flags, sizeof(unsigned short), old, rows, shift);
+  store->span = resize(store->span, sizeof(size_t), old, rows, shift);
+  store->span_length = resize(store->span_length, sizeof(int), old, rows, shift);
+  store->raw = resize(store->raw, sizeof(size_t), old, rows, shift);
+  store->raw_length = resize(store->raw_length, sizeof(int), old, rows, shift);
+  store->digest = resize(store->digest, sizeof(*store->digest), old, rows, shift);
+
+  store->base = first;
+  store->rows = rows;
+  store_index(store);
+}
+
+/*
+ * Rewrite the arena with only the strings that are still referenced
+ */
+static void compact(struct store *store) {
+  char *arena = malloc(store->arena_capacity);
+  if (!arena) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t size = 0;
+  for (int i = 0; i < store->rows; i++) {
+    if (store->flags[i] & STORE_DATA) {
+      memcpy(arena + size, store->arena + store->offset[i], store->length[i] + 1);
+      store->offset[i] = size;
+      size += store->length[i] + 1;
+    }
+  }
+
+  free(store->arena);
+  store->arena = arena;
+  store->arena_size = size;
+  store->garbage = 0;
+}
+
+/*
+ * Copy a string onto the end of the arena and return its offset
+ */
+static size_t intern(struct store *store, char *str, int length) {
+  if (store->garbage > store->arena_size / 2) {
+    compact(store);
+  }
+
+  if (store->arena_size + length + 1 > store->arena_capacity) {
+    size_t capacity = store->arena_capacity ? store->arena_capacity : 4096;
+    while (store->arena_size + length + 1 > capacity) {
+      capacity *= 2;
+    }
+    store->arena = realloc(store->arena, capacity);
+    if (!store->arena) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    store->arena_capacity = capacity;
+  }
+
+  size_t offset = store->arena_size;
+  memcpy(store->arena + offset, str, length + 1);
+  store->arena_size += length + 1;
+  return offset;
+}
+
+/*
+ * Add or remove a row's status counts from the calendar-wide totals
+ */
+static void tally(struct store *store, int row, int sign) {
+  store->summary.green += sign * store->green[row];
+  store->summary.yellow += sign * store->yellow[row];
+  store->summary.red += sign * store->red[row];
+  store->summary.blue += sign * store->blue[row];
+}
+
+/*
+ * The row flags for what count_tasks or count_escaped found
+ */
+static unsigned short task_flags(int tasks) {
+  return (tasks & TASK_INCOMPLETE ? STORE_INCOMPLETE : 0) | (tasks & TASK_IMPORTANT ? STORE_IMPORTANT : 0);
+}
+
+/*
+ * Store a day's text and the statistics derived from it
+ */
+static void put(struct store *store, int row, char *data) {
+  if (store->flags[row] & (STORE_DATA | STORE_ENCODED)) {
+    tally(store, row, -1);
+  }
+  if (store->flags[row] & STORE_DATA) {
+    store->garbage += store->length[row] + 1;
+  }
+  store->flags[row] &= ~(STORE_DATA | STORE_ENCODED | STORE_INCOMPLETE | STORE_IMPORTANT);
+
+  int length = strlen(data);
+  store->offset[row] = intern(store, data, length);
+  store->length[row] = length;
+  store->lines[row] = 0;
+  store->green[row] = 0;
+  store->yellow[row] = 0;
+  store->red[row] = 0;
+  store->blue[row] = 0;
+  int tasks = count_tasks(data, &store->lines[row], &store->green[row], &store->yellow[row], &store->red[row],
+                          &store->blue[row]);
+  store->flags[row] |= STORE_PRESENT | STORE_DATA | task_flags(tasks);
+  tally(store, row, 1);
+  index_row(store, row);
+}
+
+static void mark(struct store *store, int row) {
+  store->flags[row] &= ~(STORE_HASHED | STORE_RAW);
+  if (!(store->flags[row] & STORE_DIRTY)) {
+    store->flags[row] |= STORE_DIRTY;
+    store->dirty++;
+  }
+}
+
+/*
+ * Parse the key of the object member starting at 'p' and return the position
+ * of its value, or NULL. The key, quotes included, ends at '*key_end'.
+ */
+static const char *member(const char *p, const char *end, const char **key_end) {
+  if (p >= end || *p != '"' || !(*key_end = json_skip_string(p, end))) {
+    return NULL;
+  }
+  p = json_skip_space(*key_end, end);
+  if (p >= end || *p != ':') {
+    return NULL;
+  }
+  return json_skip_space(p + 1, end);
+}
+
+/*
+ * Step past the ',' between two members. Returns the next member, or the
+ * closing '}' with '*done' set, or NULL.
+ */
+static const char *next_member(const char *p, const char *end, int *done) {
+  p = json_skip_space(p, end);
+  *done = p < end && *p == '}';
+  if (*done) {
+    return p;
+  }
+  if (p < end && *p == ',') {
+    return json_skip_space(p + 1, end);
+  }
+  return NULL;
+}
+
+/*
+ * Parse a key or other small value into a cJSON node
+ */
+static cJSON *parse(const char *start, const char *end) { return cJSON_ParseWithLength(start, end - start); }
+
+/*
+ * Record where a day's entry is, and count its text without decoding it
+ */
+static void locate(struct store *store, int row, const char *value, const char *after) {
+  store->flags[row] |= STORE_PRESENT | STORE_RAW;
+  store->span[row] = value - store->source;
+  store->span_length[row] = after - value;
+  if (*value != '{') {
+    index_row(store, row);
+    return;
+  }
+
+  const char *key_end;
+  const char *p = json_skip_space(value + 1, after);
+  int done = 0;
+  while (p && !done && (value = member(p, after, &key_end))) {
+    const char *next = json_skip_value(value, after);
+    if (!next) {
+      break;
+    }
+
+    if (key_end - p == 6 && memcmp(p, "\"data\"", 6) == 0 && *value == '"' &&
+        !(store->flags[row] & STORE_ENCODED)) {
+      store->raw[row] = value + 1 - store->source;
+      store->raw_length[row] = next - value - 2;
+      int tasks = count_escaped(value + 1, next - value - 2, &store->lines[row], &store->green[row],
+                                &store->yellow[row], &store->red[row], &store->blue[row]);
+      store->flags[row] |= STORE_ENCODED | task_flags(tasks);
+      tally(store, row, 1);
+    } else if (key_end - p == 6 && memcmp(p, "\"mask\"", 6) == 0 && !(store->flags[row] & STORE_MASK)) {
+      cJSON *mask = parse(value, next);
+      if (cJSON_IsNumber(mask)) {
+        store->mask[row] = mask->valueint;
+        store->flags[row] |= STORE_MASK;
+      }
+      cJSON_Delete(mask);
+    }
+
+    p = next_member(next, after, &done);
+  }
+  index_row(store, row);
+}
+
+/*
+ * Locate every entry of the "days" object at 'p' whose tag is a valid date.
+ * Entries with other tags are parsed into 'dates'. Returns the position after
+ * the object, or NULL.
+ */
+static const char *locate_days(struct store *store, const char *p, cJSON *dates) {
+  const char *end = store->source + store->source_size;
+  p = json_skip_space(p + 1, end);
+  if (p < end && *p == '}') {
+    return p + 1;
+  }
+
+  int done = 0;
+  while (p && !done) {
+    const char *key_end;
+    const char *value = member(p, end, &key_end);
+    const char *after = value ? json_skip_value(value, end) : NULL;
+    if (!after) {
+      return NULL;
+    }
+
+    char tag[DATE_LEN];
+    int day;
+    int dated = key_end - p == DATE_LEN + 1;
+    if (dated) {
+      memcpy(tag, p + 1, DATE_LEN - 1);
+      tag[DATE_LEN - 1] = 0;
+      dated = date_parse(tag, &day);
+    }
+
+    if (dated) {
+      cover(store, day);
+      if (!(store->flags[day - store->base] & STORE_PRESENT)) {
+        locate(store, day - store->base, value, after);
+      }
+    } else {
+      cJSON *key = parse(p, key_end);
+      cJSON *node = parse(value, after);
+      if (!cJSON_IsString(key) || !node) {
+        cJSON_Delete(key);
+        cJSON_Delete(node);
+        return NULL;
+      }
+      cJSON_AddItemToObject(dates, key->valuestring, node);
+      cJSON_Delete(key);
+    }
+
+    p = next_member(after, end, &done);
+  }
+  return p ? p + 1 : NULL;
+}
+
+/*
+ * Take over 'buffer', the 'size' bytes of a calendar file, which is unmapped
+ * or freed along with the store. The dated entries of "days" are only located
+ * and counted here; their text is decoded by store_data() when it is first
+ * needed. Everything else is parsed into the tree that is returned. Returns
+ * NULL with '*error' set to the offset of the problem if the file is not
+ * valid.
+ */
+cJSON *store_load(struct store *store, char *buffer, size_t size, int mapped, size_t *error) {
+  store_free(store);
+  store->source = buffer;
+  store->source_size = size;
+  store->source_mapped = mapped;
+
+  const char *end = buffer + size;
+  const char *p = json_skip_space(buffer, end);
+  cJSON *root = cJSON_CreateObject();
+  if (p >= end || *p != '{') {
+    goto fail;
+  }
+  p = json_skip_space(p + 1, end);
+  if (p < end && *p == '}') {
+    return root;
+  }
+
+  int done = 0;
+  while (!done) {
+    const char *key_end;
+    const char *value = member(p, end, &key_end);
+    cJSON *key = value ? parse(p, key_end) : NULL;
+    if (!cJSON_IsString(key)) {
+      cJSON_Delete(key);
+      goto fail;
+    }
+
+    const char *after;
+    if (strcmp(key->valuestring, "days") == 0 && *value == '{' && !find(root, "days")) {
+      cJSON *dates = cJSON_CreateObject();
+      cJSON_AddItemToObject(root, "days", dates);
+      after = locate_days(store, value, dates);
+    } else {
+      after = json_skip_value(value, end);
+      cJSON *node = after ? parse(value, after) : NULL;
+      if (node) {
+        cJSON_AddItemToObject(root, key->valuestring, node);
+      } else {
+        after = NULL;
+      }
+    }
+    cJSON_Delete(key);
+
+    if (!after) {
+      p = value;
+      goto fail;
+    }
+    p = next_member(after, end, &done);
+    if (!p) {
+      p = after;
+      goto fail;
+    }
+  }
+  return root;
+
+fail:
+  *error = p ? p - buffer : 0;
+  cJSON_Delete(root);
+  return NULL;
+}
+
+/*
+ * Take ownership of a calendar file like store_load() but leave the scanning
+ * to the caller, who fills in the rows for 'first' to 'last' directly and
+ * then calls store_index(). The calendar-wide totals are the caller's to add
+ * up as well.
+ */
+void store_attach(struct store *store, char *buffer, size_t size, int mapped, int first, int last) {
+  store_free(store);
+  store->source = buffer;
+  store->source_size = size;
+  store->source_mapped = mapped;
+  if (first <= last) {
+    cover(store, first);
+    cover(store, last);
+  }
+}
+
+/*
+ * The row for a day, or -1 if the day is outside the table
+ */
+int store_row(struct store *store, int day) {
+  if (day < store->base || day >= store->base + store->rows) {
+    return -1;
+  }
+  return day - store->base;
+}
+
+/*
+ * Rebuild the day bitmaps from the flags of every row
+ */
+void store_index(struct store *store) {
+  int words = (store->rows + WORD_BITS - 1) / WORD_BITS;
+  free(store->present);
+  free(store->full);
+  store->present = calloc(words ? words : 1, sizeof(unsigned long long));
+  store->full = calloc(words ? words : 1, sizeof(unsigned long long));
+  if (!store->present || !store->full) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < store->rows; i++) {
+    index_row(store, i);
+  }
+}
+
+/*
+ * The first day from 'day' on whose bit in 'bits' is 'set'. Days outside the
+ * table count as clear. Returns INT_MAX if there is no such day.
+ */
+static int seek(struct store *store, unsigned long long *bits, int day, int set) {
+  int row = day - store->base;
+  if (row < 0 && !set) {
+    return day;
+  }
+  if (row >= store->rows) {
+    return set ? INT_MAX : day;
+  }
+  if (row < 0) {
+    row = 0;
+  }
+
+  int words = (store->rows + WORD_BITS - 1) / WORD_BITS;
+  for (int i = row / WORD_BITS; i < words; i++) {
+    unsigned long long word = set ? bits[i] : ~bits[i];
+    if (i == row / WORD_BITS) {
+      word &= ~0ULL << (row % WORD_BITS);
+    }
+    if (word) {
+      int found = i * WORD_BITS + __builtin_ctzll(word);
+      if (found >= store->rows) {
+        break;
+      }
+      return store->base + found;
+    }
+  }
+  return set ? INT_MAX : store->base + store->rows;
+}
+
+/*
+ * The first day from 'day' on that has an entry, or INT_MAX
+ */
+int store_next(struct store *store, int day) { return seek(store, store->present, day, 1); }
+
+/*
+ * The first day from 'day' on that has no entry
+ */
+int store_next_free(struct store *store, int day) { return seek(store, store->present, day, 0); }
+
+/*
+ * The first day from 'day' on that has no entry or a text of fewer than
+ * STORE_SHORT_LINES lines
+ */
+int store_next_short(struct store *store, int day) { return seek(store, store->full, day, 0); }
+
+/*
+ * The text for a day, or NULL if it has none. Text that is still escaped in
+ * the source file is decoded into the arena first, so the pointer is only
+ * valid until the next call into the store.
+ */
+char *store_data(struct store *store, int day) {
+  int row = store_row(store, day);
+  if (row < 0 || !(store->flags[row] & (STORE_DATA | STORE_ENCODED))) {
+    return NULL;
+  }
+
+  if (store->flags[row] & STORE_ENCODED) {
+    char *raw = store->source + store->raw[row];
+    cJSON *node = parse(raw - 1, raw + store->raw_length[row] + 1);
+    char *data = cJSON_IsString(node) ? node->valuestring : "";
+    store->length[row] = strlen(data);
+    store->offset[row] = intern(store, data, store->length[row]);
+    store->flags[row] = (store->flags[row] & ~STORE_ENCODED) | STORE_DATA;
+    cJSON_Delete(node);
+  }
+  return store->arena + store->offset[row];
+}
+
+/*
+ * The text for a day like store_data(), but text that is still escaped is
+ * decoded into '*scratch', grown to '*capacity' bytes as needed, and the store
+ * is left as it was. Reading many days this way does not grow the arena.
+ */
+char *store_peek(struct store *store, int day, char **scratch, size_t *capacity) {
+  int row = store_row(store, day);
+  if (row < 0 || !(store->flags[row] & (STORE_DATA | STORE_ENCODED))) {
+    return NULL;
+  }
+  if (!(store->flags[row] & STORE_ENCODED)) {
+    return store->arena + store->offset[row];
+  }
+
+  size_t length = store->raw_length[row];
+  if (*capacity < length + 1) {
+    free(*scratch);
+    *capacity = length + 1;
+    *scratch = malloc(*capacity);
+    if (!*scratch) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  json_decode_string(store->source + store->raw[row], length, *scratch);
+  return *scratch;
+}
+
+/*
+ * Set the text for a day, creating the entry if needed. The text must not
+ * point into the store itself.
+ */
+void store_set_data(struct store *store, int day, char *data) {
+  cover(store, day);
+  int row = day - store->base;
+  put(store, row, data);
+  store->flags[row] |= STORE_DATA_DIRTY;
+  mark(store, row);
+}
+
+/*
+ * Set the recurring task mask for a day, creating the entry if needed
+ */
+void store_set_mask(struct store *store, int day, int mask) {
+  cover(store, day);
+  int row = day - store->base;
+  store->mask[row] = mask;
+  store->flags[row] |= STORE_PRESENT | STORE_MASK;
+  index_row(store, row);
+  mark(store, row);
+}
+
+/*
+ * Delete the entry for a day
+ */
+void store_remove(struct store *store, int day) {
+  int row = store_row(store, day);
+  if (row < 0 || !(store->flags[row] & STORE_PRESENT)) {
+    return;
+  }
+
+  if (store->flags[row] & (STORE_DATA | STORE_ENCODED)) {
+    tally(store, row, -1);
+  }
+  if (store->flags[row] & STORE_DATA) {
+    store->garbage += store->length[row] + 1;
+  }
+  store->flags[row] &= STORE_DIRTY | STORE_DATA_DIRTY;
+  store->mask[row] = 0;
+  store->span_length[row] = 0;
+  index_row(store, row);
+  mark(store, row);
+}
+
+/*
+ * Whether two stores have the same entry for a day in their source files,
+ * byte for byte, or both have none. Both must be as they were loaded.
+ */
+int store_same_source(struct store *a, struct store *b, int day) {
+  int row_a = store_row(a, day);
+  int row_b = store_row(b, day);
+  int present_a = row_a >= 0 && a->flags[row_a] & STORE_PRESENT;
+  int present_b = row_b >= 0 && b->flags[row_b] & STORE_PRESENT;
+  if (!present_a || !present_b) {
+    return present_a == present_b;
+  }
+  return a->span_length[row_a] == b->span_length[row_b] &&
+         memcmp(a->source + a->span[row_a], b->source + b->span[row_b], a->span_length[row_a]) == 0;
+}
+
+/*
+ * Whether two stores hold the same text and mask for a day
+ */
+int store_equal(struct store *a, struct store *b, int day) {
+  int row_a = store_row(a, day);
+  int row_b = store_row(b, day);
+  int flags_a = row_a >= 0 ? a->flags[row_a] & (STORE_PRESENT | STORE_MASK) : 0;
+  int flags_b = row_b >= 0 ? b->flags[row_b] & (STORE_PRESENT | STORE_MASK) : 0;
+  if (flags_a != flags_b || (flags_a & STORE_MASK && a->mask[row_a] != b->mask[row_b])) {
+    return 0;
+  }
+
+  char *data_a = store_data(a, day);
+  char *data_b = store_data(b, day);
+  return data_a && data_b ? strcmp(data_a, data_b) == 0 : data_a == data_b;
+}
+
+/*
+ * Give a day the text and mask it has in 'from', or remove its entry if it
+ * has none there, as a change to be saved
+ */
+void store_copy(struct store *store, struct store *from, int day) {
+  int source = store_row(from, day);
+  if (source < 0 || !(from->flags[source] & STORE_PRESENT)) {
+    store_remove(store, day);
+    return;
+  }
+
+  cover(store, day);
+  int row = day - store->base;
+  char *data = store_data(from, day);
+  if (data) {
+    put(store, row, data);
+  } else {
+    if (store->flags[row] & (STORE_DATA | STORE_ENCODED)) {
+      tally(store, row, -1);
+    }
+    if (store->flags[row] & STORE_DATA) {
+      store->garbage += store->length[row] + 1;
+    }
+    store->flags[row] &= ~(STORE_DATA | STORE_ENCODED | STORE_INCOMPLETE | STORE_IMPORTANT);
+    store->lines[row] = 0;
+    store->green[row] = 0;
+    store->yellow[row] = 0;
+    store->red[row] = 0;
+    store->blue[row] = 0;
+  }
+
+  store->mask[row] = from->mask[source];
+  store->flags[row] = (store->flags[row] & ~STORE_MASK) | (from->flags[source] & STORE_MASK) | STORE_PRESENT |
+                      STORE_DATA_DIRTY;
+  index_row(store, row);
+  mark(store, row);
+}
+
+/*
+ * Take the backup digest of a day from 'from', which must have the same entry
+ * for it
+ */
+void store_keep_digest(struct store *store, struct store *from, int day) {
+  int row = store_row(store, day);
+  int source = store_row(from, day);
+  if (row >= 0 && source >= 0 && from->flags[source] & STORE_HASHED) {
+    memcpy(store->digest[row], from->digest[source], sizeof(*store->digest));
+    store->flags[row] |= STORE_HASHED;
+  }
+}
+
+/*
+ * Mark every row as saved
+ */
+void store_saved(struct store *store) {
+  for (int i = 0; i < store->rows && store->dirty; i++) {
+    if (store->flags[i] & STORE_DIRTY) {
+      store->flags[i] &= ~(STORE_DIRTY | STORE_DATA_DIRTY);
+      store->dirty--;
+    }
+  }
+}
+
+/*
+ * Take the marks off every changed row and keep them in 'marks', so that
+ * changes made afterwards can be saved on their own
+ */
+void store_hold(struct store *store, struct store_marks *marks) {
+  marks->count = 0;
+  marks->day = malloc((store->dirty + 1) * sizeof(*marks->day));
+  marks->flags = malloc((store->dirty + 1) * sizeof(*marks->flags));
+  for (int i = 0; i < store->rows && store->dirty; i++) {
+    if (store->flags[i] & STORE_DIRTY) {
+      marks->day[marks->count] = store->base + i;
+      marks->flags[marks->count] = store->flags[i] & (STORE_DIRTY | STORE_DATA_DIRTY);
+      marks->count++;
+      store->flags[i] &= ~(STORE_DIRTY | STORE_DATA_DIRTY);
+      store->dirty--;
+    }
+  }
+}
+
+/*
+ * Put back the marks taken by 'store_hold', on top of any made since, and
+ * free them
+ */
+void store_restore(struct store *store, struct store_marks *marks) {
+  for (int i = 0; i < marks->count; i++) {
+    int row = store_row(store, marks->day[i]);
+    if (row < 0) {
+      continue;
+    }
+    if (!(store->flags[row] & STORE_DIRTY)) {
+      store->dirty++;
+    }
+    store->flags[row] |= marks->flags[i];
+  }
+  free(marks->day);
+  free(marks->flags);
+  marks->count = 0;
+}
+
+/*
+ * Build the entry for a row that changed since it was loaded. Keys other than
+ * "data" and "mask" are taken from the original entry.
+ */
+static cJSON *entry_node(struct store *store, int row) {
+  cJSON *node = NULL;
+  if (store->span_length[row]) {
+    char *span = store->source + store->span[row];
+    node = parse(span, span + store->span_length[row]);
+  }
+  if (!cJSON_IsObject(node)) {
+    cJSON_Delete(node);
+    node = cJSON_CreateObject();
+  }
+
+  char *data = store_data(store, store->base + row);
+  if (!data) {
+    cJSON_DeleteItemFromObject(node, "data");
+  } else if (find(node, "data")) {
+    cJSON_ReplaceItemInObject(node, "data", cJSON_CreateString(data));
+  } else {
+    cJSON_AddItemToObject(node, "data", cJSON_CreateString(data));
+  }
+
+  cJSON *mask = find(node, "mask");
+  if (!(store->flags[row] & STORE_MASK)) {
+    cJSON_DeleteItemFromObject(node, "mask");
+  } else if (mask) {
+    cJSON_SetNumberHelper(mask, store->mask[row]);
+  } else {
+    cJSON_AddItemToObject(node, "mask", cJSON_CreateNumber(store->mask[row]));
+  }
+  return node;
+}
+
+/*
+ * Write a row's entry. One that is unchanged since it was loaded is copied
+ * from the source file as it is.
+ */
+static void write_entry(struct store *store, int row, FILE *f, int depth) {
+  if (store->flags[row] & STORE_RAW) {
+    fwrite(store->source + store->span[row], 1, store->span_length[row], f);
+    return;
+  }
+
+  cJSON *node = entry_node(store, row);
+  json_write(f, node, depth);
+  cJSON_Delete(node);
+}
+
+/*
+ * Write the "days" object: the undated entries of 'dates' followed by every
+ * row, in the layout of json_write()
+ */
+void store_write(struct store *store, FILE *f, cJSON *dates, int depth) {
+  int first = 1;
+  fputs("{\n", f);
+
+  for (cJSON *node = dates ? dates->child : NULL; node; node = node->next) {
+    fputs(first ? "" : ",\n", f);
+    first = 0;
+    json_indent(f, depth + 1);
+    json_write_string(f, node->string);
+    fputs(":\t", f);
+    json_write(f, node, depth + 1);
+  }
+
+  for (int i = 0; i < store->rows; i++) {
+    if (!(store->flags[i] & STORE_PRESENT)) {
+      continue;
+    }
+
+    char tag[DATE_LEN];
+    date_format(store->base + i, tag);
+    fputs(first ? "" : ",\n", f);
+    first = 0;
+    json_indent(f, depth + 1);
+    fprintf(f, "\"%s\":\t", tag);
+    write_entry(store, i, f, depth + 1);
+  }
+
+  fputs(first ? "" : "\n", f);
+  json_indent(f, depth);
+  putc('}', f);
+}
+
+/*
+ * The text of a row's entry as it would be written to the calendar file, in a
+ * buffer to be freed by the caller
+ */
+char *store_entry_text(struct store *store, int row) {
+  char *text = NULL;
+  size_t size = 0;
+  FILE *f = open_memstream(&text, &size);
+  if (!f) {
+    perror("open_memstream");
+    exit(EXIT_FAILURE);
+  }
+  write_entry(store, row, f, 2);
+  fclose(f);
+  return text;
+}
+
+void store_free(struct store *store) {
+  free(store->offset);
+  free(store->length);
+  free(store->lines);
+  free(store->green);
+  free(store->yellow);
+  free(store->red);
+  free(store->blue);
+  free(store->mask);
+  free(store->flags);
+  free(store->span);
+  free(store->span_length);
+  free(store->raw);
+  free(store->raw_length);
+  free(store->digest);
+  free(store->present);
+  free(store->full);
+  free(store->arena);
+  if (store->source_mapped) {
+    munmap(store->source, store->source_size);
+  } else {
+    free(store->source);
+  }
+  memset(store, 0, sizeof(struct store));
+}
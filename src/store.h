@@ -0,0 +1,119 @@
+#ifndef STORE_H
+#define STORE_H
+
+#define STORE_PRESENT 1
+#define STORE_DATA 2
+#define STORE_MASK 4
+#define STORE_DIRTY 8
+#define STORE_DATA_DIRTY 16
+#define STORE_HASHED 32
+#define STORE_RAW 64
+#define STORE_ENCODED 128
+#define STORE_INCOMPLETE 256
+#define STORE_IMPORTANT 512
+
+/*
+ * Days whose text has fewer lines than this are picked out by "next day under
+ * N lines"
+ */
+#define STORE_SHORT_LINES 4
+
+/*
+ * Calendar-wide totals shown in the top right corner of the day pane
+ */
+struct summary {
+  int green;
+  int yellow;
+  int red;
+  int blue;
+  int backlog;
+};
+
+/*
+ * Dense, day-number-indexed table of the dated entries of the "days" object.
+ * Row 'i' holds the day 'base + i', and each property lives in its own array
+ * so that scanning a range of days walks contiguous memory. Data strings are
+ * kept back to back in 'arena' and addressed by offset.
+ *
+ * Rows loaded from a file point back into it: a row flagged STORE_RAW is still
+ * exactly the 'span_length' bytes at 'span', and a row flagged STORE_ENCODED
+ * has its text at 'raw', still escaped, until it is first needed.
+ */
+struct store {
+  int base;
+  int rows;
+  size_t *offset;
+  int *length;
+  int *lines;
+  int *green;
+  int *yellow;
+  int *red;
+  int *blue;
+  int *mask;
+  unsigned short *flags;
+  size_t *span;
+  int *span_length;
+  size_t *raw;
+  int *raw_length;
+
+  /*
+   * Digest of the row's backup blob, valid while STORE_HASHED is set
+   */
+  unsigned char (*digest)[32];
+
+  /*
+   * One bit per row, set in 'present' for days with an entry and in 'full'
+   * for days with an entry that is not a text of fewer than
+   * STORE_SHORT_LINES lines, so that the next day without either is found a
+   * word at a time
+   */
+  unsigned long long *present;
+  unsigned long long *full;
+
+  char *source;
+  size_t source_size;
+  int source_mapped;
+
+  char *arena;
+  size_t arena_size;
+  size_t arena_capacity;
+  size_t garbage;
+
+  int dirty;
+  struct summary summary;
+};
+
+/*
+ * The days whose rows were marked as changed, and the marks, set aside by
+ * 'store_hold'
+ */
+struct store_marks {
+  int count;
+  int *day;
+  unsigned short *flags;
+};
+
+cJSON *store_load(struct store *store, char *buffer, size_t size, int mapped, size_t *error);
+void store_attach(struct store *store, char *buffer, size_t size, int mapped, int first, int last);
+void store_index(struct store *store);
+int store_row(struct store *store, int day);
+int store_next(struct store *store, int day);
+int store_next_free(struct store *store, int day);
+int store_next_short(struct store *store, int day);
+char *store_data(struct store *store, int day);
+char *store_peek(struct store *store, int day, char **scratch, size_t *capacity);
+void store_set_data(struct store *store, int day, char *data);
+void store_set_mask(struct store *store, int day, int mask);
+void store_remove(struct store *store, int day);
+int store_same_source(struct store *a, struct store *b, int day);
+int store_equal(struct store *a, struct store *b, int day);
+void store_copy(struct store *store, struct store *from, int day);
+void store_keep_digest(struct store *store, struct store *from, int day);
+void store_saved(struct store *store);
+void store_hold(struct store *store, struct store_marks *marks);
+void store_restore(struct store *store, struct store_marks *marks);
+void store_write(struct store *store, FILE *f, cJSON *dates, int depth);
+char *store_entry_text(struct store *store, int row);
+void store_free(struct store *store);
+
+#endif
@@ -0,0 +1,301 @@
+#include <limits.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trigram.h"
+
+/*
+ * The most trigrams a query is narrowed by. Longer literals gain little from
+ * more of them.
+ */
+#define QUERY_KEYS 64
+
+static unsigned char fold(unsigned char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+static unsigned int key(const char *p) {
+  return fold(p[0]) << 16 | fold(p[1]) << 8 | fold(p[2]);
+}
+
+static int compare_keys(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+  return (x > y) - (x < y);
+}
+
+static int compare_postings(const void *a, const void *b) {
+  return (*(struct posting *const *)a)->count - (*(struct posting *const *)b)->count;
+}
+
+/*
+ * The low bits of a product only depend on the low bits of the key, so the
+ * high ones are folded down before the table size masks them off
+ */
+static unsigned int hash(unsigned int key, int size) {
+  unsigned int h = key * 2654435761u;
+  return (h ^ h >> 15) & (size - 1);
+}
+
+/*
+ * The posting for a key, or an empty slot for it in the open-addressed table.
+ * A key is never 0, as texts hold no NUL bytes.
+ */
+static struct posting *slot(struct trigrams *trigrams, unsigned int key) {
+  unsigned int i = hash(key, trigrams->size);
+  while (trigrams->table[i].key && trigrams->table[i].key != key) {
+    i = (i + 1) & (trigrams->size - 1);
+  }
+  return &trigrams->table[i];
+}
+
+/*
+ * Keep the table at most half full
+ */
+static void reserve(struct trigrams *trigrams) {
+  if (trigrams->size && (trigrams->used + 1) * 2 <= trigrams->size) {
+    return;
+  }
+
+  struct posting *old = trigrams->table;
+  int size = trigrams->size;
+  trigrams->size = size ? size * 2 : 4096;
+  trigrams->table = calloc(trigrams->size, sizeof(struct posting));
+  if (!trigrams->table) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < size; i++) {
+    if (old[i].key) {
+      *slot(trigrams, old[i].key) = old[i];
+    }
+  }
+  free(old);
+}
+
+/*
+ * Add a text id to a posting, keeping the ids sorted. Texts are added in
+ * ascending order when the index is built, so this is usually an append.
+ */
+static void post(struct posting *posting, int doc) {
+  int at = posting->count;
+  if (at && posting->docs[at - 1] >= doc) {
+    int low = 0;
+    int high = posting->count;
+    while (low < high) {
+      int mid = low + (high - low) / 2;
+      if (posting->docs[mid] < doc) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (posting->docs[low] == doc) {
+      return;
+    }
+    at = low;
+  }
+
+  if (posting->count == posting->capacity) {
+    posting->capacity = posting->capacity ? posting->capacity * 2 : 4;
+    posting->docs = realloc(posting->docs, posting->capacity * sizeof(int));
+    if (!posting->docs) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(posting->docs + at + 1, posting->docs + at, (posting->count - at) * sizeof(int));
+  posting->docs[at] = doc;
+  posting->count++;
+}
+
+/*
+ * Index the trigrams of a text under 'doc'. Trigrams that span a line break
+ * are left out, as a pattern typed at the prompt cannot hold one. A trigram
+ * that comes up again finds 'doc' already in its posting, usually as the last
+ * id, so there is no need to sort them out first.
+ */
+void trigram_add(struct trigrams *trigrams, int doc, const char *text) {
+  for (const char *p = text; p[0] && p[1] && p[2]; p++) {
+    if (p[0] == '\n' || p[1] == '\n' || p[2] == '\n') {
+      continue;
+    }
+    unsigned int k = key(p);
+    reserve(trigrams);
+    struct posting *posting = slot(trigrams, k);
+    if (!posting->key) {
+      posting->key = k;
+      trigrams->used++;
+    }
+    if (!posting->count || posting->docs[posting->count - 1] != doc) {
+      post(posting, doc);
+    }
+  }
+
+  if (trigrams->built) {
+    trigrams->stale++;
+  } else {
+    trigrams->docs++;
+  }
+}
+
+/*
+ * Add the trigrams of a run of literal bytes to 'keys'
+ */
+static void flush(char *run, int *length, unsigned int *keys, int *count) {
+  for (int i = 0; i + 2 < *length && *count < QUERY_KEYS; i++) {
+    keys[(*count)++] = key(run + i);
+  }
+  *length = 0;
+}
+
+/*
+ * Collect the trigrams that every match of a basic regular expression must
+ * contain, from the runs of literal characters outside of groups that no
+ * repetition applies to. Anything that is not clearly such a literal ends the
+ * current run. Returns the number of trigrams, or -1 if the pattern has an
+ * alternation and so no trigram is certain.
+ */
+static int required(const char *pattern, int flags, unsigned int *keys) {
+  char run[256];
+  int length = 0;
+  int count = 0;
+  int depth = 0;
+
+  for (const char *p = pattern; *p;) {
+    unsigned char c = *p;
+    if (c == '\\' && p[1]) {
+      unsigned char next = p[1];
+      p += 2;
+      if (next == '|') {
+        return -1;
+      } else if (next == '(') {
+        flush(run, &length, keys, &count);
+        depth++;
+      } else if (next == ')') {
+        depth -= depth > 0;
+      } else if (next == '?' || next == '{') {
+        length -= length > 0;
+        flush(run, &length, keys, &count);
+        if (next == '{') {
+          char *end = strstr(p, "\\}");
+          p = end ? end + 2 : p + strlen(p);
+        }
+      } else if (next == '+' || (next >= '0' && next <= '9') || (next >= 'A' && next <= 'Z') ||
+                 (next >= 'a' && next <= 'z') || next == '<' || next == '>' || next == '`' || next == '\'') {
+        flush(run, &length, keys, &count);
+      } else if (!depth && length < (int)sizeof(run)) {
+        run[length++] = next;
+      }
+      continue;
+    }
+
+    p++;
+    if (c == '*') {
+      length -= length > 0;
+      flush(run, &length, keys, &count);
+    } else if (c == '[') {
+      flush(run, &length, keys, &count);
+      if (*p == '^') {
+        p++;
+      }
+      if (*p == ']') {
+        p++;
+      }
+      while (*p && *p != ']') {
+        if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+          char close[3] = {p[1], ']', 0};
+          char *end = strstr(p + 2, close);
+          p = end ? end + 2 : p + strlen(p);
+        } else {
+          p++;
+        }
+      }
+      if (*p) {
+        p++;
+      }
+    } else if (c == '.' || c == '^' || c == '$' || c == '\n' || depth || (flags & REG_ICASE && c >= 0x80)) {
+      flush(run, &length, keys, &count);
+    } else if (length < (int)sizeof(run)) {
+      run[length++] = c;
+    }
+  }
+  flush(run, &length, keys, &count);
+  return count;
+}
+
+/*
+ * Find the texts that might match a basic regular expression compiled with
+ * 'flags'. Returns their number, with their ids in ascending order in '*docs'
+ * to be freed by the caller, or -1 if the pattern has no literal of three
+ * characters to narrow them by and every text has to be tried.
+ */
+int trigram_query(struct trigrams *trigrams, const char *pattern, int flags, int **docs) {
+  unsigned int keys[QUERY_KEYS];
+  int count = required(pattern, flags, keys);
+  if (count <= 0) {
+    return -1;
+  }
+  *docs = NULL;
+
+  qsort(keys, count, sizeof(unsigned int), compare_keys);
+  int unique = 0;
+  for (int i = 0; i < count; i++) {
+    if (!i || keys[i] != keys[i - 1]) {
+      keys[unique++] = keys[i];
+    }
+  }
+  count = unique;
+
+  struct posting *postings[QUERY_KEYS];
+  for (int i = 0; i < count; i++) {
+    postings[i] = trigrams->size ? slot(trigrams, keys[i]) : NULL;
+    if (!postings[i] || !postings[i]->key) {
+      return 0;
+    }
+  }
+  qsort(postings, count, sizeof(struct posting *), compare_postings);
+
+  /*
+   * Start from the rarest trigram and keep the ids every other one has too,
+   * each found by a binary search from where the last one was
+   */
+  int found = postings[0]->count;
+  int *result = malloc(found * sizeof(int));
+  if (!result) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(result, postings[0]->docs, found * sizeof(int));
+  for (int i = 1; i < count && found; i++) {
+    int *ids = postings[i]->docs;
+    int kept = 0;
+    int low = 0;
+    for (int k = 0; k < found; k++) {
+      int high = postings[i]->count;
+      while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (ids[mid] < result[k]) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      if (low < postings[i]->count && ids[low] == result[k]) {
+        result[kept++] = result[k];
+      }
+    }
+    found = kept;
+  }
+
+  *docs = result;
+  return found;
+}
+
+void trigram_free(struct trigrams *trigrams) {
+  for (int i = 0; i < trigrams->size; i++) {
+    free(trigrams->table[i].docs);
+  }
+  free(trigrams->table);
+  memset(trigrams, 0, sizeof(struct trigrams));
+}
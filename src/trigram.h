@@ -0,0 +1,45 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+/*
+ * Texts that are not days are indexed under ids below every day number: the
+ * recurring tasks of each weekday from TRIGRAM_WEEKDAY (Sunday) on, and the
+ * backlog
+ */
+#define TRIGRAM_WEEKDAY INT_MIN
+#define TRIGRAM_BACKLOG (INT_MIN + 7)
+
+/*
+ * The ids of the texts that contain a trigram, in ascending order
+ */
+struct posting {
+  unsigned int key;
+  int count;
+  int capacity;
+  int *docs;
+};
+
+/*
+ * An inverted index from every three consecutive bytes of a text, with ASCII
+ * letters folded to lower case, to the texts that contain them.
+ *
+ * Trigrams are only ever added, so a text that was changed can stay listed
+ * under trigrams it no longer has. Every candidate is checked against the
+ * pattern anyway, so this only costs time, and 'stale' counts the texts added
+ * again since the index was built so that it can be rebuilt when too many
+ * are.
+ */
+struct trigrams {
+  struct posting *table;
+  int size;
+  int used;
+  int docs;
+  int stale;
+  int built;
+};
+
+void trigram_add(struct trigrams *trigrams, int doc, const char *text);
+int trigram_query(struct trigrams *trigrams, const char *pattern, int flags, int **docs);
+void trigram_free(struct trigrams *trigrams);
+
+#endif
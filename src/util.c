@@ -1,6 +1,11 @@
 #include <cjson/cJSON.h>
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "scan.h"
+#include "util.h"
+
 /*
  * Find a particular child tag of a node
  */
@@ -23,90 +28,34 @@ cJSON *find(cJSON *tree, char *str) {
 }
 
 /*
- * This function takes a string, and counts the number of lines that are
- * prepended with a '+', 'o', '-', or 'x'. The results are placed in the
- * appropriate args
- */
-void count_from_string(char *str, int *green, int *yellow, int *red, int *blue) {
-  if (str[0] == '+' && str[1] == ' ') {
-    (*green)++;
-  }
-  if (str[0] == 'o' && str[1] == ' ') {
-    (*yellow)++;
-  }
-  if (str[0] == '-' && str[1] == ' ') {
-    (*red)++;
-  }
-  if (str[0] == 'x' && str[1] == ' ') {
-    (*blue)++;
-  }
-  for (int i = 2; i < strlen(str); i++) {
-    if (str[i - 2] == '\n' && str[i - 1] == '+' && str[i] == ' ') {
-      (*green)++;
-    }
-    if (str[i - 2] == '\n' && str[i - 1] == 'o' && str[i] == ' ') {
-      (*yellow)++;
-    }
-    if (str[i - 2] == '\n' && str[i - 1] == '-' && str[i] == ' ') {
-      (*red)++;
-    }
-    if (str[i - 2] == '\n' && str[i - 1] == 'x' && str[i] == ' ') {
-      (*blue)++;
-    }
-  }
-}
-
-/*
- * This function sums up the counts returned from 'count_from_string' over all
- * dates with data
+ * Set the "data" string of a child tag, creating the child if needed
  */
-void count_status(int *green, int *yellow, int *red, int *blue, cJSON *dates) {
-  cJSON *node = dates->child;
-
-  while (1) {
-    if (!node) {
-      break;
-    }
-    cJSON *data = find(node, "data");
-    if (data) {
-      count_from_string(data->valuestring, green, yellow, red, blue);
-    }
-    node = node->next;
-  }
+void set_data(cJSON *node, char *tag, char *str) {
+  cJSON *root = find(node, tag);
+  if (!root) {
+    root = cJSON_CreateObject();
+    cJSON_AddItemToObject(node, tag, root);
+  }
+  cJSON_DeleteItemFromObject(root, "data");
+  cJSON_AddItemToObject(root, "data", cJSON_CreateString(str));
 }
 
 /*
- * This function tests whether the string contains lines that start with the
- * character 'o'. This assists with user feedback.
+ * Count the newline characters in a string
  */
-int has_incomplete_tasks(char *str) {
-  if (str[0] == 'o') {
-    return 1;
-  }
-
-  for (int i = 1; i < strlen(str); i++) {
-    if (str[i - 1] == '\n' && str[i] == 'o') {
-      return 1;
-    }
-  }
-
-  return 0;
+int count_lines(char *str) {
+  int count = 0;
+  int green = 0, yellow = 0, red = 0, blue = 0;
+  count_tasks(str, &count, &green, &yellow, &red, &blue);
+  return count;
 }
 
 /*
- * This function tests whether the string contains lines that start with the
- * character '!'. This assists with user feedback.
+ * Parse a whole string as a decimal number. Returns 1 on success.
  */
-int has_important_tasks(char *str) {
-  if (str[0] == '!') {
-    return 1;
-  }
-
-  for (int i = 1; i < strlen(str); i++) {
-    if (str[i - 1] == '\n' && str[i] == '!') {
-      return 1;
-    }
-  }
-
-  return 0;
+int parse_number(char *str, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(str, &end, 10);
+  return *str && !*end && !errno;
 }
@@ -0,0 +1,85 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+/*
+ * Start watching 'path'. Its directory is watched rather than the file
+ * itself, as most programs save by renaming a new file over the old one,
+ * which would end a watch on the old file. Symbolic links are followed, as
+ * they are when the calendar is saved. Returns 0 on success.
+ */
+int watch_open(struct watch *watch, char *path) {
+  watch->fd = -1;
+  watch->name[0] = 0;
+
+#ifdef __linux__
+  char resolved[PATH_MAX];
+  if (!realpath(path, resolved)) {
+    snprintf(resolved, PATH_MAX, "%s", path);
+  }
+  char *slash = strrchr(resolved, '/');
+  char *name = slash ? slash + 1 : resolved;
+  if (strlen(name) > NAME_MAX) {
+    return -1;
+  }
+  strcpy(watch->name, name);
+  if (slash == resolved) {
+    slash[1] = 0;
+  } else if (slash) {
+    *slash = 0;
+  } else {
+    strcpy(resolved, ".");
+  }
+
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd < 0) {
+    return -1;
+  }
+  if (inotify_add_watch(watch->fd, resolved, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    watch_close(watch);
+    return -1;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Read every pending event. Returns 1 if one of them was about the watched
+ * file, or if some were lost.
+ */
+int watch_changed(struct watch *watch) {
+  int changed = 0;
+
+#ifdef __linux__
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t size;
+  while (watch->fd >= 0 && (size = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+    struct inotify_event *event;
+    for (char *p = buffer; p < buffer + size; p += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *)p;
+      if ((event->mask & IN_Q_OVERFLOW) || (event->len && strcmp(event->name, watch->name) == 0)) {
+        changed = 1;
+      }
+    }
+  }
+#endif
+
+  return changed;
+}
+
+void watch_close(struct watch *watch) {
+  if (watch->fd >= 0) {
+    close(watch->fd);
+  }
+  watch->fd = -1;
+}
@@ -0,0 +1,18 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * Notice when another program writes the calendar file or renames a new one
+ * into its place. 'fd' becomes readable when that may have happened, and is
+ * -1 if the file cannot be watched.
+ */
+struct watch {
+  int fd;
+  char name[NAME_MAX + 1];
+};
+
+int watch_open(struct watch *watch, char *path);
+int watch_changed(struct watch *watch);
+void watch_close(struct watch *watch);
+
+#endif